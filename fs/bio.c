@@ -0,0 +1,101 @@
+/*
+ * A queue of block I/O requests of the block cache. Requests are kept sorted by block number,
+ * and each run of adjacent blocks of the same kind is issued as one request to the disk, whose
+ * cache pages are adjacent too (see 'diskaddr'). A sync thus issues a few large sequential
+ * requests instead of one per block.
+ */
+
+#include "serv.h"
+
+#define BIO_QLEN 256
+
+struct bio {
+	u_int b_blockno;
+	int b_write; // write the cached block back, or read it into the cache
+};
+
+static struct bio bio_queue[BIO_QLEN];
+static u_int bio_n;
+
+u_long diskaddr(u_int blockno);
+u_long block_is_mapped(u_int blockno);
+
+// Overview:
+//  Queue a request for 'blockno' in order. A block queued already is queued once.
+static void bio_add(u_int blockno, int write) {
+	u_int lo = 0, hi = bio_n;
+
+	while (lo < hi) {
+		u_int mid = (lo + hi) / 2;
+		if (bio_queue[mid].b_blockno < blockno) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo < bio_n && bio_queue[lo].b_blockno == blockno) {
+		// A block is read only if not cached, and written back only if cached.
+		user_assert(bio_queue[lo].b_write == write);
+		return;
+	}
+
+	if (bio_n == BIO_QLEN) {
+		bio_flush();
+		lo = 0;
+	}
+	for (u_int i = bio_n; i > lo; i--) {
+		bio_queue[i] = bio_queue[i - 1];
+	}
+	bio_queue[lo].b_blockno = blockno;
+	bio_queue[lo].b_write = write;
+	bio_n++;
+}
+
+// Overview:
+//  Queue a read of the block 'blockno' into its cache page, which must not be mapped yet.
+void bio_read(u_int blockno) {
+	bio_add(blockno, 0);
+}
+
+// Overview:
+//  Queue a write back of the cached block 'blockno'. The contents written are those when the
+//  queue is flushed, so the block must stay mapped until then.
+void bio_write(u_int blockno) {
+	bio_add(blockno, 1);
+}
+
+// Overview:
+//  Issue all queued requests in order of block number, merging adjacent ones, and wait for them.
+//
+// Post-Condition:
+//  Panic if any error occurs.
+void bio_flush(void) {
+	u_int i = 0;
+
+	while (i < bio_n) {
+		struct bio *b = &bio_queue[i];
+		u_int n = 1;
+
+		while (i + n < bio_n && bio_queue[i + n].b_write == b->b_write &&
+		       bio_queue[i + n].b_blockno == b->b_blockno + n) {
+			n++;
+		}
+
+		for (u_int j = 0; j < n; j++) {
+			u_int blockno = b->b_blockno + j;
+			if (b->b_write && !block_is_mapped(blockno)) {
+				user_panic("write unmapped block %08x", blockno);
+			}
+			if (!b->b_write && !block_is_mapped(blockno)) {
+				panic_on(syscall_mem_alloc(0, diskaddr(blockno), PTE_R | PTE_W | PTE_U));
+			}
+		}
+		if (b->b_write) {
+			ide_write(0, b->b_blockno * SECT2BLK, diskaddr(b->b_blockno), n * SECT2BLK);
+		} else {
+			ide_read(0, b->b_blockno * SECT2BLK, diskaddr(b->b_blockno), n * SECT2BLK);
+		}
+		i += n;
+	}
+	bio_n = 0;
+}
@@ -123,8 +123,8 @@ int read_block(u_int blockno, void **blk, u_int *isnew) {
 		if (isnew) {
 			*isnew = 1;
 		}
-		syscall_mem_alloc(0, va, PTE_R | PTE_W | PTE_U); // 页面标记
-		ide_read(0, blockno * SECT2BLK, va, SECT2BLK);
+		bio_read(blockno);
+		bio_flush();
 		// debugf("[ide] Read: %d(%d, %08x)->%08x\n", 0, blockno, blockno * BY2BLK, va);
 		// for (int i = 0; i < 32; i++) {
 		// 	if (block_is_mapped(i)) {
@@ -299,6 +299,12 @@ void read_bitmap(void) {
 
 	// Step 1: Calculate the number of the bitmap blocks, and read them into memory.
 	u_int nbitmap = super->s_nblocks / BIT2BLK + 1;
+	for (i = 0; i < nbitmap; i++) {
+		if (!block_is_mapped(i + 2)) {
+			bio_read(i + 2);
+		}
+	}
+	bio_flush();
 	for (i = 0; i < nbitmap; i++) {
 		read_block(i + 2, blk, 0);
 	}
@@ -776,20 +782,25 @@ void file_flush(struct File *f) {
 			continue;
 		}
 		if (block_is_dirty(diskno)) {
-			write_block(diskno);
+			bio_write(diskno);
 		}
 	}
+	bio_flush();
 }
 
 // Overview:
 //  Sync the entire file system.  A big hammer.
+//  The dirty blocks are written back, and then the disk caches are flushed, so that all of it is
+//  durable on return.
 void fs_sync(void) {
 	int i;
 	for (i = 0; i < super->s_nblocks; i++) {
 		if (block_is_dirty(i)) {
-			write_block(i);
+			bio_write(i);
 		}
 	}
+	bio_flush();
+	ide_flush(0);
 }
 
 // Overview:
@@ -956,9 +967,10 @@ void file_flush1(struct File *f) {
 			continue;
 		}
 		if (block_is_dirty(diskno)) {
-			write_block(diskno);
+			bio_write(diskno);
 		}
 	}
+	bio_flush();
 }
 
 void get_path(struct File *file, char *path) {
@@ -1544,9 +1556,10 @@ void flush_file(struct File *f) {
 			continue;
 		}
 		if (block_is_dirty(diskno)) {
-			write_block(diskno);
+			bio_write(diskno);
 		}
 	}
+	bio_flush();
 }
 
 int size_file(struct File *f, u_int newsize) {
@@ -1577,9 +1590,10 @@ void sync_fs(void) {
 	int i;
 	for (i = 0; i < super->s_nblocks; i++) {
 		if (block_is_dirty(i)) {
-			write_block(i);
+			bio_write(i);
 		}
 	}
+	bio_flush();
 }
 
 void close_file(struct File *f) {
@@ -7,13 +7,141 @@
 #include <lib.h>
 #include <mmu.h>
 
+// Sectors of the volume are striped over all disks (RAID-0): stripe 'i', of 'ide_stripe'
+// sectors, is stripe 'i / ide_ndisk' of disk 'i % ide_ndisk'.
+static u_int ide_ndisk = 1;
+static u_int ide_stripe = VBLK_MAX_SECTS; // no need to split requests to a single disk
+// Whether each disk is driven by us (see vblk.c) rather than by the kernel.
+static int ide_direct[VIRTIO_NDEV];
+
+// Overview:
+//  Read ('type' is VIRTIO_BLK_T_IN) or write ('type' is VIRTIO_BLK_T_OUT) 'nsecs' sectors of the
+//  volume from 'secno'. The pieces on different disks driven by us are posted before waiting for
+//  any of them, so that the disks work in parallel.
+static void ide_rw(u_int type, u_int secno, u_long va, u_int nsecs) {
+	while (nsecs > 0) {
+		int posted[VIRTIO_NDEV] = {0};
+
+		// Each disk takes one piece in a round.
+		while (nsecs > 0) {
+			u_int stripe = secno / ide_stripe;
+			u_int disk = stripe % ide_ndisk;
+			u_int dsecno = stripe / ide_ndisk * ide_stripe + secno % ide_stripe;
+			u_int n = MIN(nsecs, ide_stripe - secno % ide_stripe);
+
+			if (posted[disk]) {
+				break;
+			}
+			if (ide_direct[disk]) {
+				panic_on(vblk_post(disk, type, dsecno, va, n));
+				posted[disk] = 1;
+			} else if (type == VIRTIO_BLK_T_IN) {
+				panic_on(syscall_read_sector(disk, va, dsecno, n));
+			} else {
+				panic_on(syscall_write_sector(disk, va, dsecno, n));
+			}
+			secno += n;
+			va += n * BY2SECT;
+			nsecs -= n;
+		}
+
+		for (u_int disk = 0; disk < ide_ndisk; disk++) {
+			if (posted[disk]) {
+				panic_on(vblk_wait(disk));
+			}
+		}
+	}
+}
+
+static void vblk_read(u_int secno, u_long dst, u_int nsecs) {
+	ide_rw(VIRTIO_BLK_T_IN, secno, dst, nsecs);
+}
+
+static void vblk_write(u_int secno, u_long src, u_int nsecs) {
+	ide_rw(VIRTIO_BLK_T_OUT, secno, src, nsecs);
+}
+
+// Overview:
+//  Flush the write caches of all disks, those driven by us in parallel.
+static void vblk_flush(void) {
+	int posted[VIRTIO_NDEV] = {0};
+
+	for (u_int disk = 0; disk < ide_ndisk; disk++) {
+		if (ide_direct[disk]) {
+			posted[disk] = vblk_post_flush(disk);
+		} else {
+			panic_on(syscall_flush(disk));
+		}
+	}
+	for (u_int disk = 0; disk < ide_ndisk; disk++) {
+		if (posted[disk]) {
+			panic_on(vblk_wait(disk));
+		}
+	}
+}
+
+// The virtio disks, striped if there are several. Its size is known after 'ide_init'.
+static struct Blkdev vblk_dev = {"virtio", 0, vblk_read, vblk_write, vblk_flush};
+
+// The device holding the volume.
+static struct Blkdev *ide_dev = &vblk_dev;
+
+// Overview:
+//  Find the device to hold the volume: a RAM disk linked into us if any, or else the virtio
+//  disks, which are taken over from the kernel if possible, so that no syscall is needed for
+//  most requests. Otherwise the block syscalls are used. If built with 'RAMDISK_COPY', the
+//  volume is then copied to a RAM disk, and the disks are not used any more.
+//  Before this, disk 0 is used alone through the block syscalls.
+void ide_init(void) {
+	struct Disk_info di;
+	uint64_t nsecs = (uint64_t)-1;
+	u_int n = 0;
+
+	if (ramdisk_init(NULL) == 0) {
+		ide_dev = &ramdisk_dev;
+		debugf("ide: volume on the RAM disk linked in, %d sectors\n", ide_dev->bd_nsecs);
+		return;
+	}
+
+	while (n < VIRTIO_NDEV && syscall_disk_info(n, &di) == 0) {
+		ide_direct[n] = vblk_init(n) == 0;
+		debugf("ide: disk %d driven by the %s\n", n, ide_direct[n] ? "fs server" : "kernel");
+		nsecs = MIN(nsecs, di.di_capacity);
+		n++;
+	}
+	if (n == 0) {
+		user_panic("ide: no disk");
+	}
+	if (n > 1) {
+		ide_ndisk = n;
+		ide_stripe = STRIPE_SECTS;
+		nsecs = ROUNDDOWN(nsecs, STRIPE_SECTS) * n;
+		debugf("ide: striped over %d disks\n", n);
+	}
+	vblk_dev.bd_nsecs = MIN(nsecs, (u_int)-1);
+
+#ifdef RAMDISK_COPY
+	panic_on(ramdisk_init(&vblk_dev));
+	ide_dev = &ramdisk_dev;
+	debugf("ide: volume copied to a RAM disk, %d sectors\n", ide_dev->bd_nsecs);
+#endif
+}
+
+// Overview:
+//  Check that 'nsecs' sectors from 'secno' are within the volume, if its size is known.
+static void ide_check(u_int secno, u_int nsecs) {
+	if (ide_dev->bd_nsecs != 0 && (secno > ide_dev->bd_nsecs || nsecs > ide_dev->bd_nsecs - secno)) {
+		user_panic("ide: sectors %08x+%x beyond the %s volume", secno, nsecs, ide_dev->bd_name);
+	}
+}
+
 // Overview:
 //  read data from IDE disk. First issue a read request through
 //  disk register and then copy data from disk buffer
 //  (512 bytes, a sector) to destination array.
 //
 // Parameters:
-//  diskno: disk number.
+//  diskno: disk number. Only 0, the volume made of all disks, is supported.
 //  secno: start sector number.
 //  dst: destination for data read from IDE disk.
 //  nsecs: the number of sectors to read.
@@ -29,9 +157,8 @@ void ide_read(u_int diskno, u_int secno, u_long dst, u_int nsecs) {
 	// if ((u_long)dst % BY2SECT != 0) {
 	// 	user_panic("Read dst not aligned");
 	// }
-	for (u_int i = 0; i < nsecs; i++) {
-		syscall_read_sector(dst + i * BY2SECT, secno + i);
-	}
+	ide_check(secno, nsecs);
+	ide_dev->bd_read(secno, dst, nsecs);
 
 	// u_int begin = secno * BY2SECT;
 	// u_int end = begin + nsecs * BY2SECT;
@@ -60,7 +187,7 @@ void ide_read(u_int diskno, u_int secno, u_long dst, u_int nsecs) {
 //  write data to IDE disk.
 //
 // Parameters:
-//  diskno: disk number.
+//  diskno: disk number. Only 0, the volume made of all disks, is supported.
 //  secno: start sector number.
 //  src: the source data to write into IDE disk.
 //  nsecs: the number of sectors to write.
@@ -76,9 +203,8 @@ void ide_write(u_int diskno, u_int secno, u_long src, u_int nsecs) {
 	// if ((u_long)src % BY2SECT != 0) {
 	// 	user_panic("Write src not aligned");
 	// }
-	for (u_int i = 0; i < nsecs; i++) {
-		syscall_write_sector(src + i * BY2SECT, secno + i);
-	}
+	ide_check(secno, nsecs);
+	ide_dev->bd_write(secno, src, nsecs);
 
 	// u_int begin = secno * BY2SECT;
 	// u_int end = begin + nsecs * BY2SECT;
@@ -102,3 +228,17 @@ void ide_write(u_int diskno, u_int secno, u_long src, u_int nsecs) {
 
 	// }
 }
+
+// Overview:
+//  Make all data written so far durable, by flushing the write caches of the disks.
+//
+// Parameters:
+//  diskno: disk number. Only 0, the volume made of all disks, is supported.
+//
+// Post-Condition:
+//  Panic if any error occurs.
+void ide_flush(u_int diskno) {
+	if (ide_dev->bd_flush != NULL) {
+		ide_dev->bd_flush();
+	}
+}
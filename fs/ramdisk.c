@@ -0,0 +1,58 @@
+/*
+ * A RAM disk backend for the volume, so that the file system can be used (and measured) without
+ * any disk. It is either the file system image linked into the fs server (built with
+ * 'make ramdisk=image', see fs/Makefile), or a copy of the volume on the virtio disks made at
+ * mount (built with 'make ramdisk=copy'). Writes only go to memory, and are lost at shutdown.
+ */
+
+#include "serv.h"
+
+// Generated by tools/bintoc from target/fs.img if it is linked in, and 0 otherwise.
+extern unsigned char binary_ramdisk_fs_start[] __attribute__((weak));
+extern unsigned int binary_ramdisk_fs_size __attribute__((weak));
+
+// Sectors copied from the disks at a time.
+#define RAMDISK_CHUNK 256
+
+static u_char *ramdisk;
+
+static void ramdisk_read(u_int secno, u_long dst, u_int nsecs) {
+	memcpy((void *)dst, ramdisk + secno * BY2SECT, nsecs * BY2SECT);
+}
+
+static void ramdisk_write(u_int secno, u_long src, u_int nsecs) {
+	memcpy(ramdisk + secno * BY2SECT, (void *)src, nsecs * BY2SECT);
+}
+
+struct Blkdev ramdisk_dev = {"RAM disk", 0, ramdisk_read, ramdisk_write, NULL};
+
+// Overview:
+//  Set up the RAM disk: on the image linked in if any, or else on a copy of the whole of 'from'
+//  (at most 'RAMDISKMAX' bytes of it) if it is not NULL.
+//
+// Post-Condition:
+//  Return 0 on success, or -E_NOT_FOUND if there is nothing to set the RAM disk up on.
+//  Panic if the memory cannot be allocated.
+int ramdisk_init(struct Blkdev *from) {
+	if (binary_ramdisk_fs_start != NULL) {
+		ramdisk = binary_ramdisk_fs_start;
+		ramdisk_dev.bd_nsecs = binary_ramdisk_fs_size / BY2SECT;
+		return 0;
+	}
+	if (from == NULL) {
+		return -E_NOT_FOUND;
+	}
+
+	ramdisk = (u_char *)RAMDISKVA;
+	ramdisk_dev.bd_nsecs = MIN(from->bd_nsecs, RAMDISKMAX / BY2SECT);
+	// Copied by large requests, so that striped disks are read in parallel.
+	for (u_int secno = 0; secno < ramdisk_dev.bd_nsecs; secno += RAMDISK_CHUNK) {
+		u_int n = MIN(ramdisk_dev.bd_nsecs - secno, RAMDISK_CHUNK);
+		for (u_int off = 0; off < n * BY2SECT; off += BY2PG) {
+			panic_on(syscall_mem_alloc(0, RAMDISKVA + secno * BY2SECT + off,
+						   PTE_R | PTE_W | PTE_U));
+		}
+		from->bd_read(secno, RAMDISKVA + secno * BY2SECT, n);
+	}
+	return 0;
+}
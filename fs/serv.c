@@ -18,13 +18,25 @@ struct Open {
 
 // Max number of open files in the file system at once
 #define MAXOPEN 1024
-#define FILEVA 0x60000000
 
 // initialize to force into data section
 struct Open opentab[MAXOPEN] = {{0, 0, 1}};
 
-// Virtual address at which to receive page mappings containing client requests.
-#define REQVA 0x0ffff000L
+// Rings of the clients (see 'struct Fsring'), mapped from RINGVA on.
+#define MAXRING 64
+
+struct Ring {
+	u_int r_envid; // the client, or 0 if free
+	struct Fsring *r_ring;
+	int r_sync; // stopped at a sync request: RING_SYNC_WAIT, then RING_SYNC_DONE once committed
+};
+
+#define RING_SYNC_WAIT 1
+#define RING_SYNC_DONE 2
+
+struct Ring rings[MAXRING];
+
+void serve_request(u_int whom, u_int req, void *rq);
 
 // Overview:
 //  Initialize file system server process.
@@ -41,6 +53,10 @@ void serve_init(void) {
 		opentab[i].o_ff = (struct Filefd *)va;
 		va += BY2PG;
 	}
+
+	for (i = 0; i < MAXRING; i++) {
+		rings[i].r_ring = (struct Fsring *)(RINGVA + i * BY2PG);
+	}
 }
 
 // Overview:
@@ -81,9 +97,27 @@ int open_lookup(u_int envid, u_int fileid, struct Open **po) {
 	return 0;
 }
 
+// The reply to the request being served, sent by 'ipc_reply_recv' together with waiting for the
+// next request.
+static u_int reply_val;
+static u_long reply_va;
+static u_int reply_npages;
+static u_int reply_perm;
+
+static void serve_reply_range(u_int envid, u_int val, u_long va, u_int npages, u_int perm) {
+	reply_val = val;
+	reply_va = va;
+	reply_npages = npages;
+	reply_perm = perm;
+}
+
+static void serve_reply(u_int envid, u_int val, u_long va, u_int perm) {
+	serve_reply_range(envid, val, va, 1, perm);
+}
+
 // Serve requests, sending responses back to envid.
-// To send a result back, ipc_send(envid, r, 0, 0).
-// To include a page, ipc_send(envid, r, srcva, perm).
+// To send a result back, serve_reply(envid, r, 0, 0).
+// To include a page, serve_reply(envid, r, srcva, perm).
 
 void serve_open(u_int envid, struct Fsreq_open *rq) {
 	struct File *f;
@@ -93,12 +127,13 @@ void serve_open(u_int envid, struct Fsreq_open *rq) {
 
 	// Find a file id.
 	if ((r = open_alloc(&o)) < 0) {
-		ipc_send(envid, r, 0, 0);
+		serve_reply(envid, r, 0, 0);
+		return;
 	}
 
 	// Open the file.
 	if ((r = file_open(rq->req_path, &f)) < 0) {
-		ipc_send(envid, r, 0, 0);
+		serve_reply(envid, r, 0, 0);
 		return;
 	}
 
@@ -113,7 +148,7 @@ void serve_open(u_int envid, struct Fsreq_open *rq) {
 	ff->f_fd.fd_omode = o->o_mode;
 	ff->f_fd.fd_dev_id = devfile.dev_id;
 
-	ipc_send(envid, 0, (u_long)o->o_ff, PTE_R | PTE_W | PTE_U | PTE_LIBRARY); // 修改页面标记
+	serve_reply(envid, 0, (u_long)o->o_ff, PTE_R | PTE_W | PTE_U | PTE_LIBRARY); // 修改页面标记
 }
 
 void serve_map(u_int envid, struct Fsreq_map *rq) {
@@ -123,34 +158,68 @@ void serve_map(u_int envid, struct Fsreq_map *rq) {
 	int r;
 
 	if ((r = open_lookup(envid, rq->req_fileid, &pOpen)) < 0) {
-		ipc_send(envid, r, 0, 0);
+		serve_reply(envid, r, 0, 0);
 		return;
 	}
 
 	filebno = rq->req_offset / BY2BLK;
 
 	if ((r = file_get_block(pOpen->o_file, filebno, &blk)) < 0) {
-		ipc_send(envid, r, 0, 0);
+		serve_reply(envid, r, 0, 0);
 		return;
 	}
 
-	ipc_send(envid, 0, (u_long)blk, PTE_R | PTE_W | PTE_U | PTE_LIBRARY); // 修改页面标记
+	serve_reply(envid, 0, (u_long)blk, PTE_R | PTE_W | PTE_U | PTE_LIBRARY); // 修改页面标记
+}
+
+void serve_map_range(u_int envid, struct Fsreq_map_range *rq) {
+	struct Open *pOpen;
+	u_int filebno;
+	void *blk;
+	int r;
+
+	if ((r = open_lookup(envid, rq->req_fileid, &pOpen)) < 0) {
+		serve_reply(envid, r, 0, 0);
+		return;
+	}
+
+	if (rq->req_npages == 0 || rq->req_npages > RANGEMAX) {
+		serve_reply(envid, -E_INVAL, 0, 0);
+		return;
+	}
+
+	filebno = rq->req_offset / BY2BLK;
+
+	// The blocks are scattered over DISKMAP, so line them up in our own window first.
+	for (u_int i = 0; i < rq->req_npages; i++) {
+		if ((r = file_get_block(pOpen->o_file, filebno + i, &blk)) < 0) {
+			serve_reply(envid, r, 0, 0);
+			return;
+		}
+		if ((r = syscall_mem_map(0, (u_long)blk, 0, RANGEVA + i * BY2PG,
+					 PTE_R | PTE_W | PTE_U | PTE_LIBRARY)) < 0) {
+			serve_reply(envid, r, 0, 0);
+			return;
+		}
+	}
+
+	serve_reply_range(envid, 0, RANGEVA, rq->req_npages, PTE_R | PTE_W | PTE_U | PTE_LIBRARY);
 }
 
 void serve_set_size(u_int envid, struct Fsreq_set_size *rq) {
 	struct Open *pOpen;
 	int r;
 	if ((r = open_lookup(envid, rq->req_fileid, &pOpen)) < 0) {
-		ipc_send(envid, r, 0, 0);
+		serve_reply(envid, r, 0, 0);
 		return;
 	}
 
 	if ((r = file_set_size(pOpen->o_file, rq->req_size)) < 0) {
-		ipc_send(envid, r, 0, 0);
+		serve_reply(envid, r, 0, 0);
 		return;
 	}
 
-	ipc_send(envid, 0, 0, 0);
+	serve_reply(envid, 0, 0, 0);
 }
 
 void serve_close(u_int envid, struct Fsreq_close *rq) {
@@ -159,12 +228,12 @@ void serve_close(u_int envid, struct Fsreq_close *rq) {
 	int r;
 
 	if ((r = open_lookup(envid, rq->req_fileid, &pOpen)) < 0) {
-		ipc_send(envid, r, 0, 0);
+		serve_reply(envid, r, 0, 0);
 		return;
 	}
 
 	file_close(pOpen->o_file);
-	ipc_send(envid, 0, 0, 0);
+	serve_reply(envid, 0, 0, 0);
 }
 
 // Overview:
@@ -175,9 +244,9 @@ void serve_remove(u_int envid, struct Fsreq_remove *rq) {
 	/* Exercise 5.11: Your code here. (1/2) */
 	r = file_remove(rq->req_path);
 
-	// Step 2: Respond the return value to the requester 'envid' using 'ipc_send'.
+	// Step 2: Respond the return value to the requester 'envid' using 'serve_reply'.
 	/* Exercise 5.11: Your code here. (2/2) */
-	ipc_send(envid, r, 0, 0);
+	serve_reply(envid, r, 0, 0);
 
 }
 
@@ -186,21 +255,21 @@ void serve_dirty(u_int envid, struct Fsreq_dirty *rq) {
 	int r;
 
 	if ((r = open_lookup(envid, rq->req_fileid, &pOpen)) < 0) {
-		ipc_send(envid, r, 0, 0);
+		serve_reply(envid, r, 0, 0);
 		return;
 	}
 
 	if ((r = file_dirty(pOpen->o_file, rq->req_offset)) < 0) {
-		ipc_send(envid, r, 0, 0);
+		serve_reply(envid, r, 0, 0);
 		return;
 	}
 
-	ipc_send(envid, 0, 0, 0);
+	serve_reply(envid, 0, 0, 0);
 }
 
 void serve_sync(u_int envid) {
 	fs_sync();
-	ipc_send(envid, 0, 0, 0);
+	serve_reply(envid, 0, 0, 0);
 }
 
 void serve_debug(u_int envid, struct Fsreq_remove *rq) {
@@ -210,66 +279,210 @@ void serve_debug(u_int envid, struct Fsreq_remove *rq) {
 	} else if (file->f_type == FTYPE_REG) {
 		debug_file(file);
 	}
-	ipc_send(envid, 0, 0, 0);
+	serve_reply(envid, 0, 0, 0);
 }
 
-void serve(void) {
-	u_int req, whom, perm;
-
-	for (;;) {
-		perm = 0;
-
-		req = ipc_recv(&whom, REQVA, &perm);
+// Overview:
+//  Register the ring page sent at REQVA by 'envid', replacing its old ring (if any) or the ring
+//  of a dead env.
+void serve_ring_setup(u_int envid) {
+	struct Ring *rg = NULL;
+	int r;
 
-		// All requests must contain an argument page
-		if (!(perm & PTE_V)) {
-			debugf("Invalid request from %08x: no argument page\n", whom);
-			continue; // just leave it hanging, waiting for the next request.
+	for (int i = 0; i < MAXRING; i++) {
+		u_int id = rings[i].r_envid;
+		if (id == envid || id == 0 || envs[ENVX(id)].env_id != id ||
+		    envs[ENVX(id)].env_status == ENV_FREE) {
+			rg = &rings[i];
+			if (id == envid) {
+				break;
+			}
 		}
+	}
+	if (rg == NULL) {
+		serve_reply(envid, -E_MAX_OPEN, 0, 0);
+		return;
+	}
 
-		switch (req) {
-		case FSREQ_OPEN:
-			serve_open(whom, (struct Fsreq_open *)REQVA);
-			break;
+	rg->r_envid = 0;
+	rg->r_sync = 0;
+	if ((r = syscall_mem_map(0, REQVA, 0, (u_long)rg->r_ring, PTE_R | PTE_W | PTE_U)) < 0) {
+		serve_reply(envid, r, 0, 0);
+		return;
+	}
+	rg->r_envid = envid;
+	serve_reply(envid, 0, 0, 0);
+}
 
-		case FSREQ_MAP:
-			serve_map(whom, (struct Fsreq_map *)REQVA);
+// Overview:
+//  Serve the submissions in the ring of 'rg' until it is empty or its completion ring is full,
+//  then wake up the client if it is waiting for us.
+static void serve_ring(struct Ring *rg) {
+	struct Fsring *ring = rg->r_ring;
+	int progress = 0, stall = 0;
+
+	while (ring->sq_head != ring->sq_tail) {
+		if (ring->cq_tail - ring->cq_head == FSRING_SIZE) {
+			ring->sq_stall = stall = 1;
 			break;
+		}
+		__sync_synchronize();
+		struct Fsring_sqe *sqe = &ring->sq[ring->sq_head & FSRING_MASK];
+		struct Fsring_cqe *cqe = &ring->cq[ring->cq_tail & FSRING_MASK];
 
-		case FSREQ_SET_SIZE:
-			serve_set_size(whom, (struct Fsreq_set_size *)REQVA);
+		// A sync waits for the next commit (see 'serve_rings'), with the room for its completion.
+		if (sqe->sqe_op == FSREQ_SYNC && rg->r_sync != RING_SYNC_DONE) {
+			rg->r_sync = RING_SYNC_WAIT;
 			break;
+		}
 
+		serve_reply(rg->r_envid, -E_INVAL, 0, 0);
+		switch (sqe->sqe_op) {
+		case FSREQ_SET_SIZE:
 		case FSREQ_CLOSE:
-			serve_close(whom, (struct Fsreq_close *)REQVA);
-			break;
-
 		case FSREQ_DIRTY:
-			serve_dirty(whom, (struct Fsreq_dirty *)REQVA);
-			break;
-
-		case FSREQ_REMOVE:
-			serve_remove(whom, (struct Fsreq_remove *)REQVA);
+			serve_request(rg->r_envid, sqe->sqe_op, sqe->sqe_req);
 			break;
-
 		case FSREQ_SYNC:
-			serve_sync(whom);
+			rg->r_sync = 0;
+			serve_reply(rg->r_envid, 0, 0, 0);
 			break;
-
-		case FSREQ_DEBUG:
-			serve_debug(whom, (struct Fsreq_remove *)REQVA);
+		default:
+			// Requests replying with a page need an IPC.
 			break;
+		}
+		cqe->cqe_tag = sqe->sqe_tag;
+		cqe->cqe_res = reply_val;
+		__sync_synchronize();
+		ring->cq_tail++;
+		ring->sq_head++;
+		progress = 1;
+	}
 
-		case FSREQ_TREE:
-			tree_root();
-			break;
+	__sync_synchronize();
+	if (ring->cq_wait && (progress || stall)) {
+		ring->cq_wait = 0;
+		syscall_notify(rg->r_envid, FSRING_NOTIFY);
+	}
+}
 
-		default:
-			debugf("Invalid request code %d from %08x\n", whom, req);
-			break;
+// Overview:
+//  Serve the rings of all clients, after a notification.
+//  The sync requests found in a pass over the rings are committed together by one 'fs_sync', so
+//  that the disks are flushed once for all of them. Those submitted during the commit are found
+//  by the next pass, and so on until no client waits for a sync.
+static void serve_rings(void) {
+	int waiting;
+
+	do {
+		waiting = 0;
+		for (int i = 0; i < MAXRING; i++) {
+			u_int id = rings[i].r_envid;
+			if (id != 0 && envs[ENVX(id)].env_id == id &&
+			    envs[ENVX(id)].env_status != ENV_FREE) {
+				serve_ring(&rings[i]);
+				waiting |= rings[i].r_sync == RING_SYNC_WAIT;
+			}
+		}
+		if (waiting) {
+			fs_sync();
+			for (int i = 0; i < MAXRING; i++) {
+				if (rings[i].r_sync == RING_SYNC_WAIT) {
+					rings[i].r_sync = RING_SYNC_DONE;
+				}
+			}
+		}
+	} while (waiting);
+	serve_reply(0, 0, 0, 0);
+}
+
+// Overview:
+//  Dispatch the request 'req' from 'whom', whose arguments are at 'rq'.
+void serve_request(u_int whom, u_int req, void *rq) {
+	switch (req) {
+	case FSREQ_OPEN:
+		serve_open(whom, (struct Fsreq_open *)rq);
+		break;
+
+	case FSREQ_MAP:
+		serve_map(whom, (struct Fsreq_map *)rq);
+		break;
+
+	case FSREQ_MAP_RANGE:
+		serve_map_range(whom, (struct Fsreq_map_range *)rq);
+		break;
+
+	case FSREQ_SET_SIZE:
+		serve_set_size(whom, (struct Fsreq_set_size *)rq);
+		break;
+
+	case FSREQ_CLOSE:
+		serve_close(whom, (struct Fsreq_close *)rq);
+		break;
+
+	case FSREQ_DIRTY:
+		serve_dirty(whom, (struct Fsreq_dirty *)rq);
+		break;
+
+	case FSREQ_REMOVE:
+		serve_remove(whom, (struct Fsreq_remove *)rq);
+		break;
+
+	case FSREQ_SYNC:
+		serve_sync(whom);
+		break;
+
+	case FSREQ_RING:
+		serve_ring_setup(whom);
+		break;
+
+	case FSREQ_DEBUG:
+		serve_debug(whom, (struct Fsreq_remove *)rq);
+		break;
+
+	case FSREQ_TREE:
+		tree_root();
+		serve_reply(whom, 0, 0, 0);
+		break;
+
+	default:
+		debugf("Invalid request code %d from %08x\n", whom, req);
+		break;
+	}
+}
+
+void serve(void) {
+	u_int req, whom = 0, perm;
+	u_long msg[IPC_MSG_WORDS];
+	void *rq;
+
+	for (;;) {
+		perm = 0;
+
+		// Reply to the last request (if any) and wait for the next in one syscall.
+		req = ipc_reply_recv(&whom, reply_val, reply_va, reply_npages, reply_perm, REQVA,
+				     FSRING_NOTIFY, &perm, msg);
+		serve_reply(whom, -E_INVAL, 0, 0);
+
+		// A notification from envid 0: some client rings went non-empty.
+		if (whom == 0) {
+			serve_rings();
+			continue;
 		}
 
-		syscall_mem_unmap(0, REQVA);
+		// Small requests are carried in registers by 'ipc_call_msg' (with 'perm' being 0), the
+		// others in an argument page mapped at REQVA.
+		rq = (perm & PTE_V) ? (void *)REQVA : (void *)&msg[1];
+		if ((perm & PTE_V) && !is_mapped(REQVA)) {
+			debugf("Invalid request from %08x: no argument page\n", whom);
+			continue; // reply -E_INVAL, so that the caller is not left hanging.
+		}
+
+		serve_request(whom, req, rq);
+
+		if (perm & PTE_V) {
+			syscall_mem_unmap(0, REQVA);
+		}
 	}
 }
 
@@ -279,6 +492,7 @@ int main() {
 	debugf("FS is running\n");
 
 	serve_init();
+	ide_init();
 	fs_init();
 
 	serve();
@@ -10,6 +10,15 @@
 #define BY2SECT 512		    /* Bytes per disk sector */
 #define SECT2BLK (BY2BLK / BY2SECT) /* sectors to a block */
 
+/* Sectors in a stripe of a volume made of several disks. The images are
+ * split by tools/stripe with the same size. */
+#define STRIPE_SECTS SECT2BLK
+
+/* Windows of the file system server's address space, which must not overlap. */
+
+/* Virtual address at which to receive page mappings containing client requests. */
+#define REQVA 0x0ffff000L
+
 /* Disk block n, when in memory, is mapped into the file system
  * server's address space at DISKMAP+(n*BY2BLK). */
 #define DISKMAP 0x10000000
@@ -17,9 +26,53 @@
 /* Maximum disk size we can handle (1GB) */
 #define DISKMAX 0x40000000
 
+/* RAM disks are mapped from here (see ramdisk.c), up to FILEVA. */
+#define RAMDISKVA 0x50000000UL
+#define RAMDISKMAX 0x10000000
+
+/* Filefd pages of the open files, one per slot of 'opentab' (see serv.c). */
+#define FILEVA 0x60000000UL
+
+/* Window in which the blocks of a FSREQ_MAP_RANGE request are lined up, to be sent as one range.
+ * It is overwritten by the next such request. */
+#define RANGEVA 0x68000000UL
+#define RANGEMAX (MAXFILESIZE / BY2PG)
+
+/* Rings of the clients (see 'struct Fsring'), one page each. */
+#define RINGVA 0x6c000000UL
+
+/* Pages of the driver of each virtio-blk disk (see vblk.c). */
+#define VBLKBASE 0x70000000UL
+
+/* A block device the volume may be on (see ide.c). */
+struct Blkdev {
+	const char *bd_name;
+	u_int bd_nsecs; /* size in sectors, or 0 if unknown */
+	void (*bd_read)(u_int secno, u_long dst, u_int nsecs);
+	void (*bd_write)(u_int secno, u_long src, u_int nsecs);
+	void (*bd_flush)(void); /* flush the write cache, or NULL if there is none */
+};
+
 /* ide.c */
+void ide_init(void);
 void ide_read(u_int diskno, u_int secno, u_long dst, u_int nsecs);
 void ide_write(u_int diskno, u_int secno, u_long src, u_int nsecs);
+void ide_flush(u_int diskno);
+
+/* ramdisk.c */
+extern struct Blkdev ramdisk_dev;
+int ramdisk_init(struct Blkdev *from);
+
+/* vblk.c */
+int vblk_init(u_int disk);
+int vblk_post(u_int disk, u_int type, u_int secno, u_long va, u_int nsecs);
+int vblk_post_flush(u_int disk);
+int vblk_wait(u_int disk);
+
+/* bio.c */
+void bio_read(u_int blockno);
+void bio_write(u_int blockno);
+void bio_flush(void);
 
 /* fs.c */
 int file_open(char *path, struct File **pfile);
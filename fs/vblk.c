@@ -0,0 +1,153 @@
+/*
+ * A virtio-blk driver run by the file system server itself, on the disks handed over by the
+ * kernel (see 'sys_dev_map'). The device registers and the virtqueue are in our address space, so
+ * a request is posted and the device kicked without any syscall. Only waiting for the completion
+ * may block, on the notification the kernel posts for the device interrupt.
+ *
+ * Each disk has one request in flight at most, but requests to different disks may be posted
+ * before waiting for any of them (see 'ide.c').
+ */
+
+#include "serv.h"
+
+// Posted for the interrupts of disk 'disk'. FSRING_NOTIFY is the only other one taken.
+#define VBLK_NOTIFY(disk) (1 << (1 + (disk)))
+
+// Pages of the driver of disk 'disk'.
+#define VBLKVA(disk) (VBLKBASE + (disk) * 3 * BY2PG) // device registers
+#define VBLKQVA(disk) (VBLKVA(disk) + BY2PG)	     // descriptor table, available and used ring
+#define VBLKRVA(disk) (VBLKVA(disk) + 2 * BY2PG)     // header and status of the request
+
+// The queue is small enough for all of it to fit in one (physically contiguous) page.
+#define VBLK_QNUM 64
+
+#define vblk(disk) ((struct Virtio *)VBLKVA(disk))
+#define vq_desc(disk) ((struct virtq_desc *)VBLKQVA(disk))
+#define vq_avail(disk) ((struct virtq_avail *)(VBLKQVA(disk) + 1024))
+#define vq_used(disk) ((struct virtq_used *)(VBLKQVA(disk) + 2048))
+
+struct vblk_req {
+	struct virtio_blk_outhdr hdr;
+	u8 status;
+};
+
+#define vreq(disk) ((struct vblk_req *)VBLKRVA(disk))
+
+static u_short last_used[VIRTIO_NDEV];
+// Whether each disk has a write-back cache to be flushed.
+static int can_flush[VIRTIO_NDEV];
+
+// Overview:
+//  Take over disk 'disk' (see 'sys_disk_info') from the kernel and set it up.
+//
+// Post-Condition:
+//  Return 0 on success, or a negative error code if the disk is not available to us, in which
+//  case the kernel still drives it. Panic if the disk cannot be set up once taken over.
+int vblk_init(u_int disk) {
+	struct Disk_info di;
+	uint64_t features;
+
+	try(syscall_disk_info(disk, &di));
+	try(syscall_dev_map(di.di_slot, VBLKVA(disk), VBLK_NOTIFY(disk)));
+	panic_on(syscall_mem_alloc(0, VBLKQVA(disk), PTE_R | PTE_W | PTE_U));
+	panic_on(syscall_mem_alloc(0, VBLKRVA(disk), PTE_R | PTE_W | PTE_U));
+
+	vblk(disk)->status = 0;
+	vblk(disk)->status |= ACKNOWLEDGE | DRIVER;
+	// One request at a time needs none of the optional features but the cache flush.
+	if (virtio_negotiate(vblk(disk), 1ULL << VIRTIO_F_VERSION_1 | 1ULL << VIRTIO_BLK_F_FLUSH,
+			     &features) != 0 ||
+	    vblk(disk)->queue_num_max < VBLK_QNUM) {
+		vblk(disk)->status |= FAILED;
+		user_panic("vblk: cannot set up disk %d", disk);
+	}
+
+	vblk(disk)->queue_sel = 0;
+	vblk(disk)->queue_num = VBLK_QNUM;
+	vblk(disk)->queue_desc = va2pa(vq_desc(disk));
+	vblk(disk)->queue_avail = va2pa(vq_avail(disk));
+	vblk(disk)->queue_used = va2pa(vq_used(disk));
+	vblk(disk)->queue_ready = 1;
+	vblk(disk)->status |= DRIVER_OK;
+	can_flush[disk] = (features & 1ULL << VIRTIO_BLK_F_FLUSH) != 0;
+	return 0;
+}
+
+// Overview:
+//  Post a read ('type' is VIRTIO_BLK_T_IN) or write ('type' is VIRTIO_BLK_T_OUT) of 'nsecs'
+//  sectors from 'secno' of disk 'disk' to or from the mapped buffer at 'va', without waiting
+//  for it (see 'vblk_wait'). The device accesses the pages of the buffer directly.
+//
+// Post-Condition:
+//  Return 0 on success, or -E_INVAL if the buffer is too large or not mapped.
+int vblk_post(u_int disk, u_int type, u_int secno, u_long va, u_int nsecs) {
+	struct virtq_desc *desc = vq_desc(disk);
+	u_long len = nsecs * BY2SECT;
+	u_short data_flags = type == VIRTIO_BLK_T_IN ? VIRTQ_DESC_F_WRITE : 0;
+	u_int d = 0;
+
+	vreq(disk)->hdr.type = type;
+	vreq(disk)->hdr.reserved = 0;
+	vreq(disk)->hdr.sector = secno;
+	vreq(disk)->status = -1;
+
+	desc[0].addr = va2pa(&vreq(disk)->hdr);
+	desc[0].len = sizeof(vreq(disk)->hdr);
+	desc[0].flags = VIRTQ_DESC_F_NEXT;
+	desc[0].next = 1;
+
+	// One descriptor for each page of the buffer.
+	while (len > 0) {
+		u_long n = MIN(len, BY2PG - va % BY2PG);
+		if (++d == VBLK_QNUM - 1 || !is_mapped(va)) {
+			return -E_INVAL;
+		}
+		desc[d].addr = va2pa(va);
+		desc[d].len = n;
+		desc[d].flags = VIRTQ_DESC_F_NEXT | data_flags;
+		desc[d].next = d + 1;
+		va += n;
+		len -= n;
+	}
+
+	d++;
+	desc[d].addr = va2pa(&vreq(disk)->status);
+	desc[d].len = 1;
+	desc[d].flags = VIRTQ_DESC_F_WRITE;
+
+	vq_avail(disk)->ring[vq_avail(disk)->idx % VBLK_QNUM] = 0;
+	__sync_synchronize();
+	vq_avail(disk)->idx++;
+	__sync_synchronize();
+	vblk(disk)->queue_notify = 0;
+	return 0;
+}
+
+// Overview:
+//  Post a flush of the write cache of disk 'disk', as 'vblk_post' does, if it has one.
+//
+// Post-Condition:
+//  Return 1 if the flush is posted, and is to be waited for, or 0 if there is nothing to flush.
+int vblk_post_flush(u_int disk) {
+	if (!can_flush[disk]) {
+		return 0;
+	}
+	panic_on(vblk_post(disk, VIRTIO_BLK_T_FLUSH, 0, 0, 0));
+	return 1;
+}
+
+// Overview:
+//  Wait for the request posted to disk 'disk' to complete.
+//
+// Post-Condition:
+//  Return 0 on success, or -E_IO if the disk fails the request.
+int vblk_wait(u_int disk) {
+	// A completion between the check and the wait leaves the notification pending.
+	while (vq_used(disk)->idx == last_used[disk]) {
+		syscall_notify_wait(VBLK_NOTIFY(disk));
+	}
+	__sync_synchronize();
+	last_used[disk]++;
+
+	return vreq(disk)->status == VIRTIO_BLK_S_OK ? 0 : -E_IO;
+}
@@ -0,0 +1,29 @@
+#ifndef _BALLOON_H_
+#define _BALLOON_H_
+
+#include <types.h>
+
+// Queues of a virtio-balloon device.
+#define BALLOON_INFLATEQ 0
+#define BALLOON_DEFLATEQ 1
+
+// Features of a virtio-balloon device.
+#define VIRTIO_BALLOON_F_MUST_TELL_HOST 0
+#define VIRTIO_BALLOON_F_DEFLATE_ON_OOM 2
+
+// Pages given to or taken from the host in one request, and reclaimed at a time on memory
+// pressure.
+#define BALLOON_BATCH 256
+
+// Page frame numbers in the requests are always of 4 KiB pages.
+#define BALLOON_PFN_SHIFT 12
+
+struct virtio_balloon_config {
+	u_int num_pages; // pages the host wants in the balloon
+	u_int actual;	 // pages in the balloon
+};
+
+int balloon_init(u_int slot);
+u_int balloon_reclaim(void);
+
+#endif /* !_BALLOON_H_ */
@@ -1,7 +1,11 @@
 #ifndef _CONSOLE_H_
 #define _CONSOLE_H_
 
+#include <types.h>
+
 void printcharc(char ch);
+void printbufc(const char *buf, size_t len);
+void printflush(void);
 int scancharc(void);
 void halt(void);
 
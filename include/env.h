@@ -7,16 +7,44 @@
 #include <types.h>
 #include <virtio.h>
 #include <sbi.h>
+#include <timer.h>
 
 #define LOG2NENV 10
 #define NENV (1 << LOG2NENV)
 #define ENVX(envid) ((envid) & (NENV - 1))
 
+// Index in 'envs' of the file system server, which the kernel creates second.
+#define FS_SERV_ENVX 1
+
 // Values of env_status in struct Env
 #define ENV_FREE 0
 #define ENV_RUNNABLE 1
 #define ENV_NOT_RUNNABLE 2
 
+// Notification bits usable with 'sys_notify'. The highest bit is reserved, so that the bits taken
+// are never returned as a negative error.
+#define NOTIFY_ALL 0x7fffffff
+
+// Number of words of a register-carried IPC message, passed in $a1..$a6.
+#define IPC_MSG_WORDS 6
+
+// Exit statuses are truncated to this mask, so that 'sys_wait' never returns them as an error.
+#define EXIT_STATUS_MASK 0xff
+
+// Scheduling statistics of an env. Times are in cycles of 'timer_now'.
+struct Env_stat {
+	uint64_t es_run;	// time spent running
+	uint64_t es_wait;	// time spent runnable but waiting for the CPU
+	uint64_t es_block;	// time spent blocked
+	uint64_t es_ipc;	// time spent blocked in IPC, included in 'es_block'
+	u_int es_voluntary;	// switches away because of yielding or blocking
+	u_int es_involuntary;	// switches away because the time slice ran out
+	u_int es_runs;		// same as 'env_runs'
+};
+
+// FIFO of envs blocked on something, linked by 'env_wait_link'.
+TAILQ_HEAD(Env_wait_list, Env);
+
 struct Env {
 	struct Trapframe env_tf;  // Saved registers
 	LIST_ENTRY(Env) env_link; // Free list
@@ -27,18 +55,47 @@ struct Env {
 	u_long env_pgdir;		  // Kernel virtual address of page dir
 	TAILQ_ENTRY(Env) env_sched_link;
 	u_int env_pri;
+	u_int env_base_pri; // 'env_pri' without priority lent by an IPC sender
+	u_int env_donor;    // envid of the sender lending its priority, or 0
 	// Lab 4 IPC
 	u_long env_ipc_value;   // data value sent to us 改为了 64 位
 	u_int env_ipc_from;    // envid of the sender
 	u_int env_ipc_recving; // env is blocked receiving
 	u_long env_ipc_dstva;   // va at which to map received page 改为了 64 位
+	u_int env_ipc_dstnpages; // number of pages that may be mapped from 'env_ipc_dstva' on
 	u_int env_ipc_perm;    // perm of page mapping received
+	struct Env_wait_list env_ipc_senders; // envs blocked in 'sys_ipc_send' to us
+	u_long env_ipc_send_msg[IPC_MSG_WORDS]; // message of our blocked 'sys_ipc_send'
+	u_long env_ipc_send_srcva;
+	u_int env_ipc_send_perm; // 0 for a register-carried message
+	u_int env_ipc_calling; // our queued send is a 'sys_ipc_call' waiting for the reply
+	u_int env_ipc_callee;  // envid of the env which took our 'sys_ipc_call' and owes the reply
+	struct Env_wait_list env_ipc_callers; // envs whose 'sys_ipc_call' we took, owed a reply
+	u_int env_notify;      // pending notification bits, ORed in by 'sys_notify'
+	u_int env_notify_mask; // bits waited for in 'sys_notify_wait' or 'sys_ipc_recv', or 0
 
 	// Lab 4 fault handling
 	u_long env_user_tlb_mod_entry; // user tlb mod handler 改为了 64 位
 
 	// Lab 6 scheduler counts
 	u_int env_runs; // number of times been env_run'ed
+
+	// Wakes the env up when it sleeps or blocks with a timeout
+	struct Timer env_timer;
+
+	// Wait queue the env is blocked on, or NULL
+	TAILQ_ENTRY(Env) env_wait_link;
+	struct Env_wait_list *env_waitq;
+	u_long env_futex_pa; // physical address of the word waited on in 'sys_futex_wait'
+
+	// Scheduling statistics
+	struct Env_stat env_stat;
+	uint64_t env_stat_stamp; // time the env started running, waiting or being blocked
+	u_int env_stat_ipc;	 // whether the env is blocked in IPC
+
+	// Exit status given to 'env_destroy', kept after the env is freed until its slot is reused
+	u_int env_exit_status;
+	struct Env_wait_list env_exit_waiters; // envs blocked in 'sys_wait' for us
 };
 
 LIST_HEAD(Env_list, Env);
@@ -50,10 +107,18 @@ void env_init(void);
 int env_alloc(struct Env **e, u_int parent_id);
 void env_free(struct Env *);
 struct Env *env_create(const void *binary, size_t size, int priority);
-void env_destroy(struct Env *e);
+void env_destroy(struct Env *e, u_int status);
 
 int envid2env(u_int envid, struct Env **penv, int checkperm);
 void env_run(struct Env *e) __attribute__((noreturn));
+void env_stat_block(struct Env *e);
+void env_block(struct Env *e, uint64_t expire);
+void env_wakeup(struct Env *e, u_long ret);
+void env_set_msg(struct Env *e, const u_long *msg);
+void env_notify(struct Env *e, u_int bits);
+void env_wait(struct Env *e, struct Env_wait_list *q);
+struct Env *env_wait_dequeue(struct Env_wait_list *q);
+void env_get_stat(struct Env *e, struct Env_stat *st);
 void enable_irq(void);
 
 void env_check(void);
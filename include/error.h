@@ -44,6 +44,18 @@
 // File not a valid executable
 #define E_NOT_EXEC 13
 
+// Blocking operation timed out
+#define E_TIMEOUT 14
+
+// The value waited for has already changed
+#define E_AGAIN 15
+
+// The device failed the I/O request
+#define E_IO 16
+
+// Operation not permitted to the caller
+#define E_PERM 17
+
 /*
  * A quick wrapper around function calls to propagate errors.
  * Use this with caution, as it leaks resources we've acquired so far.
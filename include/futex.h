@@ -0,0 +1,13 @@
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+#include <env.h>
+
+// Number of hashed wait queues of 'sys_futex_wait'.
+#define FUTEX_HASH 64
+
+void futex_init(void);
+void futex_wait(struct Env *e, u_long pa);
+int futex_wake(u_long pa, u_int n);
+
+#endif /* !_FUTEX_H_ */
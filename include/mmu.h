@@ -136,6 +136,19 @@
 	#define UTEMP 0x003fe000L
 #endif
 
+// MMIO devices of the QEMU virt machine. A device at physical address 'pa' is mapped by the kernel
+// at 'pa + DEVOFFSET' (see 'env_init').
+#define DEVOFFSET 0xa0000000L
+#define PLIC_BASE 0x0c000000L
+#define PLIC_SIZE 0x00400000L
+#define UART_BASE 0x10000000L
+#define VIRTIO_BASE 0x10001000L
+#define VIRTIO_END 0x10009000L
+
+#define IS_DEVICE_PA(pa)                                                                           \
+	(((pa) >= PLIC_BASE && (pa) < PLIC_BASE + PLIC_SIZE) ||                                    \
+	 ((pa) >= UART_BASE && (pa) < VIRTIO_END))
+
 
 #ifndef __ASSEMBLER__
 
@@ -0,0 +1,23 @@
+#ifndef _PLIC_H_
+#define _PLIC_H_
+
+#include <mmu.h>
+
+// Register offsets of the PLIC, for the S-mode context (context 1) of hart 0.
+#define PLIC_PRIORITY 0x0	    // 4 bytes per source
+#define PLIC_SENABLE 0x2080	    // enable bits of context 1
+#define PLIC_SCONTEXT 0x201000	    // base of the threshold and claim registers of context 1
+#define PLIC_STHRESHOLD PLIC_SCONTEXT
+#define PLIC_SCLAIM (PLIC_SCONTEXT + 4)
+
+#define PLIC_VA (PLIC_BASE + DEVOFFSET)
+
+// Interrupt sources of the QEMU virt machine.
+#define IRQ_VIRTIO0 1 // virtio-mmio devices are 1..8
+#define IRQ_UART 10
+
+void plic_init(void);
+void plic_enable(u_int irq);
+void plic_intr(void);
+
+#endif /* !_PLIC_H_ */
@@ -3,6 +3,8 @@
 
 #ifndef __ASSEMBLER__
 
+#include <types.h>
+
 enum {
 	SYS_putchar,
 	SYS_print_cons,
@@ -25,9 +27,35 @@ enum {
 	SYS_read_sector,
 	SYS_write_sector,
 	SYS_flush,
+	SYS_sleep,
+	SYS_ipc_send,
+	SYS_env_stat,
+	SYS_ipc_call,
+	SYS_ipc_reply_recv,
+	SYS_ipc_call_msg,
+	SYS_notify,
+	SYS_notify_wait,
+	SYS_batch,
+	SYS_wait,
+	SYS_futex_wait,
+	SYS_futex_wake,
+	SYS_dev_map,
+	SYS_disk_info,
 	MAX_SYSNO,
 };
 
+// Max number of requests executed by one 'sys_batch'.
+#define SYSREQ_MAX 64
+
+// One request of 'sys_batch'. 'sr_sysno' is one of 'SYS_mem_alloc', 'SYS_mem_map',
+// 'SYS_mem_unmap', 'SYS_set_env_status' and 'SYS_futex_wake', whose arguments are taken from
+// 'sr_args' in order.
+struct Sysreq {
+	u_long sr_sysno;
+	u_long sr_args[5];
+	long sr_ret; // written by the kernel: 0, or the error of the failed request
+};
+
 #endif
 
 void do_syscall(struct Trapframe *tf);
@@ -0,0 +1,62 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include <queue.h>
+#include <types.h>
+
+// Frequency of the 'time' CSR on the QEMU virt machine.
+#define TIMER_FREQ 10000000L
+#define NS_PER_CYCLE (1000000000L / TIMER_FREQ)
+
+// One tick of the timer wheel is 1 ms.
+#define TIMER_TICK (TIMER_FREQ / 1000)
+
+// The wheel has 'TW_LEVELS' levels of 'TW_SIZE' slots each. Level 'l' covers timers expiring
+// within 'TW_SIZE ^ (l + 1)' ticks, so 4 levels of 64 slots reach about 4.6 hours.
+#define TW_BITS 6
+#define TW_SIZE (1 << TW_BITS)
+#define TW_MASK (TW_SIZE - 1)
+#define TW_LEVELS 4
+
+#define TIMER_NEVER ((uint64_t)-1)
+
+struct Timer {
+	LIST_ENTRY(Timer) t_link;
+	uint64_t t_expire;	     // expire time, in ticks
+	int t_pending;		     // whether the timer is in the wheel
+	void (*t_func)(void *data); // called when the timer expires
+	void *t_data;
+};
+
+LIST_HEAD(Timer_list, Timer);
+
+static inline uint64_t timer_now(void) {
+#ifdef RISCV32
+	u_long lo, hi, tmp;
+	do {
+		asm volatile("rdtimeh %0" : "=r"(hi));
+		asm volatile("rdtime %0" : "=r"(lo));
+		asm volatile("rdtimeh %0" : "=r"(tmp));
+	} while (hi != tmp);
+	return ((uint64_t)hi << 32) | lo;
+#else // riscv64
+	u_long t;
+	asm volatile("rdtime %0" : "=r"(t));
+	return t;
+#endif
+}
+
+static inline uint64_t ns2cycles(uint64_t ns) {
+	return ns / NS_PER_CYCLE;
+}
+
+void timer_init(void);
+void timer_setup(struct Timer *t, void (*func)(void *), void *data);
+void timer_add(struct Timer *t, uint64_t expire);
+void timer_cancel(struct Timer *t);
+void timer_run(void);
+int timer_pending(void);
+uint64_t timer_next(void);
+void timer_idle(void);
+
+#endif /* !_TIMER_H_ */
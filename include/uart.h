@@ -0,0 +1,42 @@
+#ifndef _UART_H_
+#define _UART_H_
+
+#include <env.h>
+
+// Registers of the ns16550 UART, one byte each.
+#define UART_RBR 0 // receive buffer (read)
+#define UART_THR 0 // transmit holding register (write)
+#define UART_IER 1 // interrupt enable
+#define UART_FCR 2 // FIFO control (write)
+#define UART_MCR 4 // modem control
+#define UART_LSR 5 // line status
+
+#define UART_IER_RDI 0x01  // interrupt when data is received
+#define UART_IER_THRI 0x02 // interrupt when the transmit FIFO is empty
+#define UART_FCR_FIFO 0x07 // enable and clear the FIFOs
+#define UART_MCR_OUT2 0x08 // route the interrupt out of the chip
+#define UART_LSR_DR 0x01   // data ready
+#define UART_LSR_THRE 0x20 // transmit FIFO empty
+#define UART_LSR_TEMT 0x40 // transmitter idle
+
+#define UART_FIFO_SIZE 16
+
+#define UART_VA (UART_BASE + DEVOFFSET)
+
+// Size of the input ring buffer, a power of 2.
+#define UART_RING_SIZE 256
+
+// Size of the output ring buffer, a power of 2.
+#define UART_TX_SIZE 4096
+
+void uart_init(void);
+int uart_ready(void);
+void uart_putc(char ch);
+void uart_flush(void);
+void uart_intr(void);
+void cons_input(u_char ch);
+int uart_getc(void);
+void uart_wait(struct Env *e);
+int uart_waiting(void);
+
+#endif /* !_UART_H_ */
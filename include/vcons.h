@@ -0,0 +1,23 @@
+#ifndef _VCONS_H_
+#define _VCONS_H_
+
+#include <types.h>
+
+// Queues of port 0 of a virtio-console device (without VIRTIO_CONSOLE_F_MULTIPORT).
+#define VCONS_RXQ 0
+#define VCONS_TXQ 1
+
+// Size of the output ring buffer, a power of 2.
+#define VCONS_TX_SIZE 16384
+
+// Receive buffers posted to the device, and the size of each.
+#define VCONS_RX_NBUF 8
+#define VCONS_RX_BUF 64
+
+int vcons_init(u_int slot);
+int vcons_ready(void);
+void vcons_putc(char ch);
+void vcons_write(const char *buf, u_long len);
+void vcons_flush(void);
+
+#endif /* !_VCONS_H_ */
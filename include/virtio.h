@@ -1,6 +1,9 @@
 #ifndef _VIRTIO_H_
 #define _VIRTIO_H_
 
+#include <error.h>
+#include <mmu.h>
+#include <queue.h>
 #include <types.h>
 #include <virtio_queue.h>
 
@@ -71,12 +74,10 @@ struct Virtio {
     volatile struct virtio_blk_config config;
 };
 
-struct virtio_blk_req {
+struct virtio_blk_outhdr {
     le32 type;
     le32 reserved;
     le64 sector;
-    u8 data[512];
-    u8 status;
 };
 
 #define VIRTIO_BLK_T_IN 0
@@ -92,6 +93,13 @@ struct virtio_blk_req {
 // 24 to 32 Feature bits reserved for extensions to the queue and feature negotiation mechanisms
 // 33 and above Feature bits reserved for future extensions.
 
+#define VIRTIO_BLK_F_SIZE_MAX 1 // 'size_max' is the maximum size of a segment
+#define VIRTIO_BLK_F_SEG_MAX 2	// 'seg_max' is the maximum number of segments in a request
+#define VIRTIO_BLK_F_BLK_SIZE 6 // 'blk_size' is the block size of the disk
+#define VIRTIO_BLK_F_FLUSH 9	// the cache flush command is supported
+
+#define VIRTIO_F_VERSION_1 32
+
 #define ACKNOWLEDGE (1)
 #define DRIVER (2)
 #define FAILED (128)
@@ -99,14 +107,111 @@ struct virtio_blk_req {
 #define DRIVER_OK (4)
 #define DEVICE_NEEDS_RESET (64)
 
-extern struct virtio_blk_req read_buffer;
-extern struct virtio_blk_req write_buffer;
-extern struct virtio_blk_req flush_buffer;
+// Bits of 'interrupt_status'.
+#define VIRTIO_INT_USED (1) // a buffer has been used
+#define VIRTIO_INT_CONFIG (2)
+
+// The eight virtio-mmio slots of the QEMU virt machine, one page each. Slot 'i' raises PLIC
+// interrupt 'IRQ_VIRTIO0 + i'.
+#define VIRTIO_NDEV 8
+#define VIRTIO_VA(i) (VIRTIO_BASE + DEVOFFSET + (i) * PAGE_SIZE)
+
+// A virtqueue of up to 'VIRTQ_PAGE_NUM' entries fits in one page with the event indices: the
+// descriptor table at 0, the available ring at 'VIRTQ_AVAIL_OFF' and the used ring at
+// 'VIRTQ_USED_OFF' (see 'virtq_setup').
+#define VIRTQ_PAGE_NUM 128
+#define VIRTQ_AVAIL_OFF (VIRTQ_PAGE_NUM * 16)
+#define VIRTQ_USED_OFF (VIRTQ_AVAIL_OFF + 512)
+
+// Sectors in one block request at most, and the pages they may span.
+#define VBLK_MAX_SECTS 32
+#define VBLK_MAX_SEGS (VBLK_MAX_SECTS * SECTOR_SIZE / PAGE_SIZE + 1)
+
+struct Env;
+
+/* Overview:
+ *   Negotiate the features of 'dev', whose status has ACKNOWLEDGE and DRIVER set: accept those
+ *   of 'wanted' it offers, and store them in 'features'.
+ *
+ * Post-Condition:
+ *   Return 0 on success, with FEATURES_OK set.
+ *   Return -E_IO if the device does not accept the subset, in which case it is unusable.
+ */
+static inline int virtio_negotiate(struct Virtio *dev, uint64_t wanted, uint64_t *features) {
+	uint64_t offered;
+
+	dev->device_features_sel = 0;
+	offered = dev->device_features;
+	dev->device_features_sel = 1;
+	offered |= (uint64_t)dev->device_features << 32;
+
+	*features = offered & wanted;
+	dev->driver_features_sel = 0;
+	dev->driver_features = (u_int)*features;
+	dev->driver_features_sel = 1;
+	dev->driver_features = (u_int)(*features >> 32);
+
+	dev->status |= FEATURES_OK;
+	return (dev->status & FEATURES_OK) ? 0 : -E_IO;
+}
+
+/* Overview:
+ *   Return the capacity of the virtio-blk device 'dev' in sectors. The two halves are read
+ *   again if the device changed its configuration in between.
+ */
+static inline uint64_t virtio_blk_capacity(struct Virtio *dev) {
+	volatile le32 *cap = (volatile le32 *)&dev->config.capacity;
+	u_int gen, lo, hi;
+
+	do {
+		gen = dev->config_generation;
+		lo = cap[0];
+		hi = cap[1];
+	} while (gen != dev->config_generation);
+	return ((uint64_t)hi << 32) | lo;
+}
+
+// A physically contiguous piece of the data of a block request. Each is one data descriptor.
+struct Vblk_seg {
+	u_long pa;
+	u_long len;
+};
+
+/*
+ * A block request of an env. Each env has at most one in flight, which it is blocked on.
+ * 'r_hdr' and 'r_status' are read and written by the device, the data goes directly to or from
+ * the pages of the env, which are pinned until the request completes.
+ */
+struct Vblk_req {
+	struct virtio_blk_outhdr r_hdr;
+	u8 r_status;
+	int r_busy;		      // submitted and not completed yet
+	struct Env *r_env;	      // woken up on completion, NULL if freed in the meantime
+	u_int r_disk;		      // index of the disk (see 'sys_disk_info')
+	u_int r_nseg;
+	struct Vblk_seg r_seg[VBLK_MAX_SEGS];
+	// The descriptor chain, made available as one indirect descriptor if the device supports
+	// it, or copied to the descriptor table otherwise.
+	struct virtq_desc r_table[VBLK_MAX_SEGS + 2] __attribute__((aligned(16)));
+	TAILQ_ENTRY(Vblk_req) r_link; // pending on its disk while waiting for descriptors
+};
+
+// What 'sys_disk_info' tells about a disk.
+struct Disk_info {
+	u_int di_slot;	      // virtio-mmio slot, for 'sys_dev_map'
+	uint64_t di_capacity; // in sectors
+};
 
 void virtio_init();
-void read_sector(struct Virtio *disk, le64 sector);
-void write_sector(struct Virtio *disk, le64 sector);
-void flush(struct Virtio *disk);
-void debug_sector(struct virtio_blk_req buffer);
+int virtq_setup(struct Virtio *dev, u_int sel, struct virtq *vq, void *page);
+void virtio_set_intr(u_int slot, void (*handler)(u_int slot));
+struct Vblk_req *vblk_req_get(struct Env *e);
+int vblk_submit(struct Vblk_req *r);
+int vblk_info(u_int disk, struct Disk_info *info);
+void virtio_intr(u_int slot);
+int virtio_busy(void);
+int virtio_grant(struct Env *e, u_int slot, u_int bits);
+int virtio_granted(struct Env *e, u_long pa);
+void virtio_env_free(struct Env *e);
 
 #endif /* !_VIRTIO_H_ */
@@ -0,0 +1,195 @@
+#include <balloon.h>
+#include <error.h>
+#include <pmap.h>
+#include <printk.h>
+#include <virtio.h>
+
+#ifdef RISCV32
+typedef le32 le;
+#else
+typedef le64 le;
+#endif
+
+/*
+ * A virtio-balloon driver, so that the memory left free is given back to the host. When the host
+ * asks for pages, they are taken off 'page_free_list' and reported to it, and when it lets them
+ * go, or 'page_alloc' runs out of memory, they are taken back.
+ *
+ * A request lists the page frame numbers of up to 'BALLOON_BATCH' pages, and is waited for by
+ * polling, as the kernel runs with interrupts disabled. The host handles it on the notification.
+ * Only the configuration change interrupts are taken, when the host sets a new size.
+ */
+
+static struct Virtio *balloon;
+static uint64_t balloon_features;
+static struct virtq inflq, deflq;
+static u_char balloon_rings[2][PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static u_short infl_last_used, defl_last_used;
+
+static u_int balloon_pfns[BALLOON_BATCH];
+
+// Pages in the balloon, which belong to the host.
+static struct Page_list balloon_list;
+static u_int balloon_npages;
+// The size the balloon is resized to: the one the host asked for last, lowered by the pages taken
+// back on memory pressure, so that they are not given to the host again until it asks anew.
+static u_int balloon_target;
+
+static void balloon_intr(u_int slot);
+static void balloon_resize(void);
+
+/* Overview:
+ *   Set up the virtio-balloon device in virtio-mmio 'slot', and give the host the pages it asks
+ *   for already.
+ *
+ * Post-Condition:
+ *   Return 0 on success, or -E_IO if the device is unusable, with FAILED set.
+ */
+int balloon_init(u_int slot) {
+	struct Virtio *dev = (struct Virtio *)VIRTIO_VA(slot);
+	uint64_t wanted = 1ULL << VIRTIO_F_VERSION_1 | 1ULL << VIRTIO_BALLOON_F_MUST_TELL_HOST |
+			  1ULL << VIRTIO_BALLOON_F_DEFLATE_ON_OOM;
+
+	dev->status = 0;
+	dev->status |= ACKNOWLEDGE | DRIVER;
+	if (virtio_negotiate(dev, wanted, &balloon_features) != 0 ||
+	    virtq_setup(dev, BALLOON_INFLATEQ, &inflq, balloon_rings[0]) != 0 ||
+	    virtq_setup(dev, BALLOON_DEFLATEQ, &deflq, balloon_rings[1]) != 0) {
+		dev->status |= FAILED;
+		return -E_IO;
+	}
+	dev->status |= DRIVER_OK;
+
+	// Completions are polled for.
+	inflq.avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+	deflq.avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+
+	LIST_INIT(&balloon_list);
+	balloon = dev;
+	virtio_set_intr(slot, balloon_intr);
+	balloon_resize();
+	return 0;
+}
+
+/* Overview:
+ *   Send the first 'n' page frame numbers of 'balloon_pfns' on queue 'sel' ('vq'), and wait for
+ *   the host to take them.
+ */
+static void balloon_send(u_int sel, struct virtq *vq, u_short *last_used, u_int n) {
+	vq->desc[0].addr = (le)balloon_pfns;
+	vq->desc[0].len = n * sizeof(balloon_pfns[0]);
+	vq->desc[0].flags = 0;
+	vq->avail->ring[vq->avail->idx % vq->num] = 0;
+	// The device must see the buffer before the new index.
+	__sync_synchronize();
+	vq->avail->idx++;
+	__sync_synchronize();
+	balloon->queue_notify = sel;
+
+	while (vq->used->idx == *last_used) {
+	}
+	__sync_synchronize();
+	(*last_used)++;
+}
+
+static void balloon_set_actual(void) {
+	((volatile struct virtio_balloon_config *)&balloon->config)->actual = balloon_npages;
+}
+
+/* Overview:
+ *   Give the host up to 'n' free pages, at most 'BALLOON_BATCH' of them.
+ *
+ * Post-Condition:
+ *   Return the number of pages given, which is 0 if there are no free pages.
+ */
+static u_int balloon_inflate(u_int n) {
+	struct Page *pp;
+	u_int k = 0;
+
+	while (k < MIN(n, BALLOON_BATCH) && (pp = LIST_FIRST(&page_free_list)) != NULL) {
+		LIST_REMOVE(pp, pp_link);
+		LIST_INSERT_HEAD(&balloon_list, pp, pp_link);
+		balloon_pfns[k++] = page2pa(pp) >> BALLOON_PFN_SHIFT;
+	}
+	if (k > 0) {
+		balloon_send(BALLOON_INFLATEQ, &inflq, &infl_last_used, k);
+		balloon_npages += k;
+	}
+	return k;
+}
+
+/* Overview:
+ *   Take back up to 'n' pages from the host, at most 'BALLOON_BATCH' of them, and free them.
+ *
+ * Post-Condition:
+ *   Return the number of pages taken back, which is 0 if the balloon is empty.
+ */
+static u_int balloon_deflate(u_int n) {
+	struct Page *pp;
+	struct Page_list taken;
+	u_int k = 0;
+
+	LIST_INIT(&taken);
+	while (k < MIN(n, BALLOON_BATCH) && (pp = LIST_FIRST(&balloon_list)) != NULL) {
+		LIST_REMOVE(pp, pp_link);
+		LIST_INSERT_HEAD(&taken, pp, pp_link);
+		balloon_pfns[k++] = page2pa(pp) >> BALLOON_PFN_SHIFT;
+	}
+	if (k == 0) {
+		return 0;
+	}
+	// The pages may be used only after the host is told, if it asks so.
+	balloon_send(BALLOON_DEFLATEQ, &deflq, &defl_last_used, k);
+	balloon_npages -= k;
+	while ((pp = LIST_FIRST(&taken)) != NULL) {
+		LIST_REMOVE(pp, pp_link);
+		page_free(pp);
+	}
+	return k;
+}
+
+/* Overview:
+ *   Take back pages from the balloon when 'page_alloc' finds no free pages, if the host lets us.
+ *
+ * Post-Condition:
+ *   Return the number of pages freed, which is 0 if none can be.
+ */
+u_int balloon_reclaim(void) {
+	u_int n;
+
+	if (balloon == NULL || !(balloon_features & 1ULL << VIRTIO_BALLOON_F_DEFLATE_ON_OOM)) {
+		return 0;
+	}
+	n = balloon_deflate(BALLOON_BATCH);
+	if (n > 0) {
+		balloon_target = MIN(balloon_target, balloon_npages);
+		balloon_set_actual();
+	}
+	return n;
+}
+
+/* Overview:
+ *   Inflate or deflate the balloon to the size the host asks for, as far as there are free pages.
+ */
+static void balloon_resize(void) {
+	balloon_target = ((volatile struct virtio_balloon_config *)&balloon->config)->num_pages;
+	while (balloon_npages < balloon_target &&
+	       balloon_inflate(balloon_target - balloon_npages) > 0) {
+	}
+	while (balloon_npages > balloon_target &&
+	       balloon_deflate(balloon_npages - balloon_target) > 0) {
+	}
+	balloon_set_actual();
+}
+
+/* Overview:
+ *   Resize the balloon when the host changes the size it asks for.
+ */
+static void balloon_intr(u_int slot) {
+	u_int status = balloon->interrupt_status;
+
+	balloon->interrupt_ack = status;
+	if (status & VIRTIO_INT_CONFIG) {
+		balloon_resize();
+	}
+}
@@ -1,15 +1,70 @@
 #include <drivers/dev_cons.h>
 #include <sbi.h>
 #include <mmu.h>
+#if !defined(LAB) || LAB >= 3
+#include <uart.h>
+#endif
+#if !defined(LAB) || LAB >= 4
+#include <vcons.h>
+#endif
 
+/* Overview:
+ *   Print 'ch' through the virtio console if there is one, or else through the UART driver once
+ *   it is up, or through the SBI during early boot.
+ */
 void printcharc(char ch) {
+#if !defined(LAB) || LAB >= 4
+	if (vcons_ready()) {
+		vcons_putc(ch);
+		return;
+	}
+#endif
+#if !defined(LAB) || LAB >= 3
+	if (uart_ready()) {
+		uart_putc(ch);
+		return;
+	}
+#endif
 	sbi_console_putchar(ch);
 }
 
+/* Overview:
+ *   Print the 'len' characters at 'buf' as 'printcharc' does. The virtio console sends them in
+ *   one buffer.
+ */
+void printbufc(const char *buf, size_t len) {
+#if !defined(LAB) || LAB >= 4
+	if (vcons_ready()) {
+		vcons_write(buf, len);
+		return;
+	}
+#endif
+	for (size_t i = 0; i < len; i++) {
+		printcharc(buf[i]);
+	}
+}
+
 char scancharc(void) {
 	return (char) sbi_console_getchar();
 }
 
+/* Overview:
+ *   Wait until all output queued by 'printcharc' is sent.
+ */
+void printflush(void) {
+#if !defined(LAB) || LAB >= 4
+	if (vcons_ready()) {
+		vcons_flush();
+	}
+#endif
+#if !defined(LAB) || LAB >= 3
+	if (uart_ready()) {
+		uart_flush();
+	}
+#endif
+}
+
 void halt(void) {
+	printflush();
 	sbi_shutdown();
 }
@@ -1,5 +1,8 @@
 #include <elf.h>
 #include <env.h>
+#include <futex.h>
+#include <plic.h>
+#include <uart.h>
 #include <mmu.h>
 #include <pmap.h>
 #include <printk.h>
@@ -25,6 +28,11 @@ static uint64_t time = 20000000L;
 
 static uint32_t asid_bitmap[NASID / 32] = {0}; // 64
 
+static struct Env *stat_running = NULL; // the env whose run time is being accounted
+
+static void env_timeout(void *data);
+static void env_unwait(struct Env *e);
+
 /* Overview:
  *  Allocate an unused ASID.
  *
@@ -198,6 +206,14 @@ void env_init(void) {
 		    PTE_R | PTE_G | PTE_U);
 	map_pages(&base_pgdir, 0, 0x80000000, 0x80000000, 0x0000000004000000, PTE_R | PTE_W | PTE_X);
 	map_pages(&base_pgdir, 0, 0x10001000, 0xb0001000, 0x0000000000008000, PTE_R | PTE_W | PTE_X);
+	map_pages(&base_pgdir, 0, UART_BASE, UART_VA, PAGE_SIZE, PTE_R | PTE_W);
+	// Only the pages of the PLIC used by 'plic_init': priorities, and the enable bits, threshold
+	// and claim register of the S-mode context of hart 0.
+	map_pages(&base_pgdir, 0, PLIC_BASE, PLIC_VA, PAGE_SIZE, PTE_R | PTE_W);
+	map_pages(&base_pgdir, 0, ROUNDDOWN(PLIC_BASE + PLIC_SENABLE, PAGE_SIZE),
+		  ROUNDDOWN(PLIC_VA + PLIC_SENABLE, PAGE_SIZE), PAGE_SIZE, PTE_R | PTE_W);
+	map_pages(&base_pgdir, 0, PLIC_BASE + PLIC_SCONTEXT, PLIC_VA + PLIC_SCONTEXT, PAGE_SIZE,
+		  PTE_R | PTE_W);
 
 	// for (u_long pa = KERNBASE + 0x0000000; pa < KERNBASE + MEMORY_SIZE; pa += PAGE_SIZE) {
 	// 	if (pa2page(pa)->pp_ref != 1) {
@@ -255,6 +271,11 @@ void env_init(void) {
 	
 	printk("page table is good\n");
 
+	timer_init();
+	futex_init();
+	plic_init();
+	uart_init();
+
 	#if !defined(LAB) || LAB >= 5
 		virtio_init();
 	#endif
@@ -363,6 +384,20 @@ int env_alloc(struct Env **new, u_int parent_id) {
 
 	e->env_user_tlb_mod_entry = 0; // for lab4
 	e->env_runs = 0;	       // for lab6
+	e->env_donor = 0;
+	e->env_waitq = NULL;
+	e->env_ipc_calling = 0;
+	e->env_ipc_callee = 0;
+	e->env_notify = 0;
+	e->env_notify_mask = 0;
+	TAILQ_INIT(&e->env_ipc_senders);
+	TAILQ_INIT(&e->env_ipc_callers);
+	TAILQ_INIT(&e->env_exit_waiters);
+	e->env_exit_status = 0;
+	memset(&e->env_stat, 0, sizeof(e->env_stat));
+	e->env_stat_stamp = timer_now();
+	e->env_stat_ipc = 0;
+	timer_setup(&e->env_timer, env_timeout, e);
 	/* Exercise 3.4: Your code here. (3/4) */
 	e->env_id = mkenvid(e);
 	try(asid_alloc(&e->env_asid));
@@ -521,6 +556,7 @@ struct Env *env_create(const void *binary, size_t size, int priority) {
 	/* Step 2: Assign the 'priority' to 'e' and mark its 'env_status' as runnable. */
 	/* Exercise 3.7: Your code here. (2/3) */
 	e->env_pri = priority;
+	e->env_base_pri = priority;
 	e->env_status = ENV_RUNNABLE;
 
 	/* Step 3: Use 'load_icode' to load the image from 'binary', and insert 'e' into
@@ -603,19 +639,50 @@ void env_free(struct Env *e) {
 	// asid_free(e->env_asid);
 	// /* Hint: invalidate page directory in TLB */
 	// tlb_invalidate(e->env_asid, UVPT + (PDX(UVPT) << PGSHIFT));
+	timer_cancel(&e->env_timer);
+	env_unwait(e);
+#if !defined(LAB) || LAB >= 4
+	virtio_env_free(e);
+#endif
+	if (stat_running == e) {
+		stat_running = NULL;
+	}
+
+	// Senders still blocked on 'e' would never be received.
+	struct Env *sender;
+	while ((sender = env_wait_dequeue(&e->env_ipc_senders)) != NULL) {
+		env_wakeup(sender, -E_BAD_ENV);
+	}
+
+	// Neither would the callers whose requests 'e' has taken ever get the reply.
+	struct Env *caller;
+	while ((caller = env_wait_dequeue(&e->env_ipc_callers)) != NULL) {
+		env_wakeup(caller, -E_BAD_ENV);
+	}
+
+	// Envs waiting for 'e' to exit get its exit status from their 'sys_wait'.
+	struct Env *waiter;
+	while ((waiter = env_wait_dequeue(&e->env_exit_waiters)) != NULL) {
+		env_wakeup(waiter, e->env_exit_status);
+	}
+
 	/* Hint: return the environment to the free list. */
+	if (e->env_status == ENV_RUNNABLE) {
+		TAILQ_REMOVE(&env_sched_list, (e), env_sched_link);
+	}
 	e->env_status = ENV_FREE;
 	LIST_INSERT_HEAD((&env_free_list), (e), env_link);
-	TAILQ_REMOVE(&env_sched_list, (e), env_sched_link);
 
 	e = TAILQ_FIRST(&env_sched_list);
 }
 
 /* Overview:
- *  Free env e, and schedule to run a new env if e is the current env.
+ *  Free env e with exit status 'status' (truncated to 'EXIT_STATUS_MASK'), and schedule to run a
+ *  new env if e is the current env.
  */
-void env_destroy(struct Env *e) {
+void env_destroy(struct Env *e, u_int status) {
 	/* Hint: free e. */
+	e->env_exit_status = status & EXIT_STATUS_MASK;
 	env_free(e);
 
 	/* Hint: schedule to run a new environment. */
@@ -630,6 +697,166 @@ void env_destroy(struct Env *e) {
 	}
 }
 
+/* Overview:
+ *   Set the value returned to 'e' by the syscall it is blocked in.
+ *   The trapframe of 'curenv' is still on the kernel stack until it is switched out by 'env_run'.
+ */
+static void env_set_retval(struct Env *e, u_long ret) {
+	if (e == curenv) {
+		((struct Trapframe *)KSTACKTOP - 1)->regs[10] = ret;
+	} else {
+		e->env_tf.regs[10] = ret;
+	}
+}
+
+/* Overview:
+ *   Set the IPC message words returned to 'e' in $a1..$a6 by the syscall it is blocked in.
+ */
+void env_set_msg(struct Env *e, const u_long *msg) {
+	struct Trapframe *tf = e == curenv ? (struct Trapframe *)KSTACKTOP - 1 : &e->env_tf;
+	for (int i = 0; i < IPC_MSG_WORDS; i++) {
+		tf->regs[11 + i] = msg[i];
+	}
+}
+
+/* Overview:
+ *   Account the runnable env 'e' leaving 'env_sched_list' in its statistics: the time it ran is
+ *   charged if it is being timed, and it is blocked from now on.
+ */
+void env_stat_block(struct Env *e) {
+	uint64_t now = timer_now();
+	if (stat_running == e) {
+		e->env_stat.es_run += now - e->env_stat_stamp;
+		stat_running = NULL;
+	}
+	e->env_stat_stamp = now;
+}
+
+/* Overview:
+ *   Block the runnable env 'e' and remove it from 'env_sched_list'. It returns 0 from its
+ *   syscall when woken up, unless 'env_wakeup' says otherwise.
+ *   If 'expire' is not 'TIMER_NEVER', 'e' is woken up by its timer at 'expire' (in cycles).
+ */
+void env_block(struct Env *e, uint64_t expire) {
+	assert(e->env_status == ENV_RUNNABLE);
+	env_stat_block(e);
+	e->env_status = ENV_NOT_RUNNABLE;
+	TAILQ_REMOVE(&env_sched_list, e, env_sched_link);
+	env_set_retval(e, 0);
+	if (expire != TIMER_NEVER) {
+		timer_add(&e->env_timer, expire);
+	}
+}
+
+/* Overview:
+ *   Append the blocked env 'e' to the wait queue 'q'.
+ */
+void env_wait(struct Env *e, struct Env_wait_list *q) {
+	TAILQ_INSERT_TAIL(q, e, env_wait_link);
+	e->env_waitq = q;
+}
+
+/* Overview:
+ *   Remove 'e' from the wait queue it is on, if any.
+ */
+static void env_unwait(struct Env *e) {
+	if (e->env_waitq) {
+		TAILQ_REMOVE(e->env_waitq, e, env_wait_link);
+		e->env_waitq = NULL;
+	}
+}
+
+/* Overview:
+ *   Remove and return the first env of the wait queue 'q', or NULL if it is empty.
+ *   The env stays blocked until 'env_wakeup' is called.
+ */
+struct Env *env_wait_dequeue(struct Env_wait_list *q) {
+	struct Env *e = TAILQ_FIRST(q);
+	if (e) {
+		env_unwait(e);
+	}
+	return e;
+}
+
+/* Overview:
+ *   Make the blocked env 'e' runnable again, returning 'ret' from its syscall, which ends its
+ *   receive if it was receiving.
+ */
+void env_wakeup(struct Env *e, u_long ret) {
+	timer_cancel(&e->env_timer);
+	env_unwait(e);
+	e->env_ipc_recving = 0;
+	e->env_ipc_calling = 0;
+	e->env_ipc_callee = 0;
+	e->env_notify_mask = 0;
+	env_set_retval(e, ret);
+	if (e->env_status != ENV_RUNNABLE) {
+		uint64_t now = timer_now();
+		e->env_stat.es_block += now - e->env_stat_stamp;
+		if (e->env_stat_ipc) {
+			e->env_stat.es_ipc += now - e->env_stat_stamp;
+			e->env_stat_ipc = 0;
+		}
+		e->env_stat_stamp = now;
+		e->env_status = ENV_RUNNABLE;
+		TAILQ_INSERT_TAIL(&env_sched_list, e, env_sched_link);
+	}
+}
+
+/* Overview:
+ *   Account the switch from the env being timed (if any) to 'e' in their statistics.
+ *   An env switched away from while runnable starts waiting for the CPU.
+ */
+static void env_stat_switch(struct Env *e) {
+	uint64_t now;
+
+	if (stat_running == e) {
+		return;
+	}
+	now = timer_now();
+	if (stat_running) {
+		stat_running->env_stat.es_run += now - stat_running->env_stat_stamp;
+		stat_running->env_stat_stamp = now;
+	}
+	e->env_stat.es_wait += now - e->env_stat_stamp;
+	e->env_stat_stamp = now;
+	stat_running = e;
+}
+
+/* Overview:
+ *   Copy the statistics of 'e' to 'st', including the time of its current state.
+ */
+void env_get_stat(struct Env *e, struct Env_stat *st) {
+	uint64_t delta = timer_now() - e->env_stat_stamp;
+
+	*st = e->env_stat;
+	st->es_runs = e->env_runs;
+	if (stat_running == e) {
+		st->es_run += delta;
+	} else if (e->env_status == ENV_RUNNABLE) {
+		st->es_wait += delta;
+	} else {
+		st->es_block += delta;
+		if (e->env_stat_ipc) {
+			st->es_ipc += delta;
+		}
+	}
+}
+
+/* Overview:
+ *   Timer handler of a sleeping env. An env still receiving has its 'sys_ipc_recv' timed out, and
+ *   so does an env still on a wait queue (e.g. in 'sys_futex_wait').
+ */
+static void env_timeout(void *data) {
+	struct Env *e = (struct Env *)data;
+
+	if (e->env_ipc_recving || e->env_waitq) {
+		env_wakeup(e, -E_TIMEOUT);
+	} else {
+		env_wakeup(e, 0);
+	}
+}
+
 /* Overview:
  *   This function is depended by our judge framework. Please do not modify it.
  */
@@ -650,7 +877,7 @@ static inline void pre_env_run(struct Env *e) {
 	if (epc == MOS_SCHED_END_PC) {
 		printk("env %08x reached end pc: 0x%08x, $v0=0x%08x\n", e->env_id, epc,
 		       tf->regs[2]);
-		env_destroy(e);
+		env_destroy(e, 0);
 		schedule(0);
 	}
 #endif
@@ -680,6 +907,8 @@ void env_run(struct Env *e) {
 		curenv->env_tf = *((struct Trapframe *)KSTACKTOP - 1);
 	}
 
+	env_stat_switch(e);
+
 	/* Step 2: Change 'curenv' to 'e'. */
 	curenv = e;
 	curenv->env_runs++; // lab6
@@ -794,13 +1023,20 @@ void env_run(struct Env *e) {
 	// printk("%016lx\n", PTE2PA(((u_long *)PAGE_TABLE)[0x400]));
 
 
-	int r = sbi_set_timer(time); // 时间不能太短，如果 10000000L 就会立刻中断
+	// After idling, the next time slice starts from now instead of the past.
+	uint64_t now = timer_now();
+	if (time < now) {
+		time = now + delta_time;
+	}
+	// Interrupt earlier if a timer of the wheel expires in this time slice.
+	uint64_t next = timer_next();
+	int r = sbi_set_timer(next < time ? next : time); // 时间不能太短，如果 10000000L 就会立刻中断
 	assert(r == 0);
 	time += delta_time;
 	// printk("timer=%d\n", r);
 
 	// e->env_tf.sip &=~ SIP_STIP; // 不可以写入 sip，因为没用
-	e->env_tf.sie |= SIE_STIE;
+	e->env_tf.sie |= SIE_STIE | SIE_SEIE;
 	e->env_tf.sstatus |= SSTATUS_SPIE; // 不可以 SIE，否则会立刻中断
 
 	// u_long sip;					// sip 不可写入！只能通过 ecall 来修改 sip
@@ -8,6 +8,9 @@
 #include <trap.h>
 #include <sched.h>
 #include <syscall.h>
+#include <timer.h>
+#include <plic.h>
+#include <asm/csrdef.h>
 
 extern void handle_int(void);
 extern void handle_tlb(void);
@@ -50,9 +53,19 @@ void handle_interrupt() {
 	// printk("int!\n");
 	// print_tf(((struct Trapframe *)KSTACKTOP - 1));
 	asm volatile("csrr %0, sip " : "=r"(sip));
-	if (sip & 0x0000000000000020) {
+	if (sip & SIP_SEIP) {
+		plic_intr();
+	}
+	if (sip & SIP_STIP) {
+		timer_run();
 		schedule(0);
 	}
+	if (sip & SIP_SEIP) {
+		// Go back to the interrupted env. The readers woken up run when it is switched out.
+		struct Trapframe *tf = (struct Trapframe *)KSTACKTOP - 1;
+		asm volatile("add sp, %0, zero" : : "r"(tf));
+		asm volatile("j ret_from_exception");
+	}
 	printk("sip=%016lx\n", sip);
 	halt();
 }
@@ -0,0 +1,44 @@
+#include <futex.h>
+
+// Envs blocked in 'sys_futex_wait', hashed by the physical address of the word they wait on, so
+// that envs mapping the same page at different addresses meet in the same queue.
+static struct Env_wait_list futex_queues[FUTEX_HASH];
+
+static struct Env_wait_list *futex_queue(u_long pa) {
+	return &futex_queues[((pa >> 2) ^ (pa >> 12)) % FUTEX_HASH];
+}
+
+void futex_init(void) {
+	for (int i = 0; i < FUTEX_HASH; i++) {
+		TAILQ_INIT(&futex_queues[i]);
+	}
+}
+
+/* Overview:
+ *   Queue the blocked env 'e' as waiting on the word at physical address 'pa'.
+ */
+void futex_wait(struct Env *e, u_long pa) {
+	e->env_futex_pa = pa;
+	env_wait(e, futex_queue(pa));
+}
+
+/* Overview:
+ *   Wake up at most 'n' envs waiting on the word at physical address 'pa', in FIFO order.
+ *
+ * Post-Condition:
+ *   Return the number of envs woken up.
+ */
+int futex_wake(u_long pa, u_int n) {
+	struct Env_wait_list *q = futex_queue(pa);
+	struct Env *e, *next;
+	int woken = 0;
+
+	for (e = TAILQ_FIRST(q); e != NULL && woken < n; e = next) {
+		next = TAILQ_NEXT(e, env_wait_link);
+		if (e->env_futex_pa == pa) {
+			env_wakeup(e, 0);
+			woken++;
+		}
+	}
+	return woken;
+}
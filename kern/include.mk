@@ -7,7 +7,8 @@ ifeq ($(call lab-ge,2), true)
 endif
 
 ifeq ($(call lab-ge,3), true)
-	targets     += env.o env_asm.o sched.o entry.o genex.o kclock.o traps.o exception.o exception_entry.o
+	targets     += env.o env_asm.o sched.o entry.o genex.o kclock.o traps.o exception.o exception_entry.o timer.o futex.o \
+		       plic.o uart.o
 endif
 
 ifeq ($(call lab-ge,4), true)
@@ -15,5 +16,5 @@ ifeq ($(call lab-ge,4), true)
 endif
 
 ifeq ($(call lab-ge,4), true)
-	targets     += virtio.o
+	targets     += virtio.o vcons.o balloon.o
 endif
\ No newline at end of file
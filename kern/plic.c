@@ -0,0 +1,46 @@
+#include <asm/csrdef.h>
+#include <plic.h>
+#include <printk.h>
+#include <uart.h>
+#include <virtio.h>
+
+#define PLIC_REG(off) (*(volatile u_int *)(PLIC_VA + (off)))
+
+/* Overview:
+ *   Accept interrupts of any priority in the S-mode context of hart 0, and let them trap.
+ *   Sources are enabled one by one with 'plic_enable'.
+ */
+void plic_init(void) {
+	PLIC_REG(PLIC_STHRESHOLD) = 0;
+	asm volatile("csrs sie, %0" : : "r"(SIE_SEIE));
+}
+
+void plic_enable(u_int irq) {
+	PLIC_REG(PLIC_PRIORITY + irq * 4) = 1;
+	PLIC_REG(PLIC_SENABLE + irq / 32 * 4) |= 1 << (irq % 32);
+}
+
+/* Overview:
+ *   Claim and serve all pending external interrupts.
+ */
+void plic_intr(void) {
+	u_int irq;
+
+	while ((irq = PLIC_REG(PLIC_SCLAIM)) != 0) {
+		switch (irq) {
+		case IRQ_UART:
+			uart_intr();
+			break;
+		default:
+#if !defined(LAB) || LAB >= 4
+			if (irq >= IRQ_VIRTIO0 && irq < IRQ_VIRTIO0 + VIRTIO_NDEV) {
+				virtio_intr(irq - IRQ_VIRTIO0);
+				break;
+			}
+#endif
+			printk("plic: unexpected irq %d\n", irq);
+			break;
+		}
+		PLIC_REG(PLIC_SCLAIM) = irq;
+	}
+}
@@ -1,3 +1,4 @@
+#include <balloon.h>
 #include <drivers/dev_mp.h>
 #include <env.h>
 #include <mmu.h>
@@ -120,7 +121,14 @@ int page_alloc(struct Page **new) {
 	struct Page *pp;
 	/* Exercise 2.4: Your code here. (1/2) */
 	if (LIST_EMPTY(&page_free_list)) {
+#if !defined(LAB) || LAB >= 4
+		// Take memory back from the host if it is in the balloon.
+		if (balloon_reclaim() == 0) {
+			return -E_NO_MEM;
+		}
+#else
 		return -E_NO_MEM;
+#endif
 	}
 	pp = LIST_FIRST(&page_free_list);
 
@@ -149,6 +157,16 @@ void page_free(struct Page *pp) {
 
 }
 
+/* Overview:
+ *   Drop a reference to the page at 'pa' mapped by a page table, and free it if none is left.
+ *   Device pages have no 'struct Page', and are left alone.
+ */
+static void pa_decref(u_long pa) {
+	if (pa >= KERNBASE && pa < KERNBASE + MEMORY_SIZE) {
+		page_decref(pa2page(pa));
+	}
+}
+
 // /* Overview:
 //  *   Given 'pgdir', a pointer to a page directory, 'pgdir_walk' returns a pointer to the page table
 //  *   entry (with permission PTE_D|PTE_V) for virtual address 'va'.
@@ -278,18 +296,18 @@ void page_free(struct Page *pp) {
 // 	return pp;
 // }
 
-// /* Overview:
-//  *   Decrease the 'pp_ref' value of Page 'pp'.
-//  *   When there's no references (mapped virtual address) to this page, release it.
-//  */
-// void page_decref(struct Page *pp) {
-// 	assert(pp->pp_ref > 0);
+/* Overview:
+ *   Decrease the 'pp_ref' value of Page 'pp'.
+ *   When there's no references (mapped virtual address) to this page, release it.
+ */
+void page_decref(struct Page *pp) {
+	assert(pp->pp_ref > 0);
 
-// 	/* If 'pp_ref' reaches to 0, free this page. */
-// 	if (--pp->pp_ref == 0) {
-// 		page_free(pp);
-// 	}
-// }
+	/* If 'pp_ref' reaches to 0, free this page. */
+	if (--pp->pp_ref == 0) {
+		page_free(pp);
+	}
+}
 
 // // Overview:
 // //   Unmap the physical page at virtual address 'va'.
@@ -764,9 +782,7 @@ int alloc_page(u_long *pgdir, u_int asid, u_long va, u_int perm) {
 			if (*pte0 & PTE_V) {
 				u_long original_pa = PTE2PA(*pte0);
 				// clear
-				if (--pa2page(original_pa)->pp_ref == 0) {
-					page_free(pa2page(original_pa));
-				}
+				pa_decref(original_pa);
 				goto map;
 			} else {
 				goto map;
@@ -811,7 +827,7 @@ int map_page(u_long *pgdir, u_int asid, u_long va, u_long pa, u_int perm) {
 		panic("invalid perm: %08x", perm);
 	}
 
-	if ((pa < KERNBASE || pa >= KERNBASE + MEMORY_SIZE) && (pa < 0x10001000 || pa >= 0x10009000)) { 
+	if ((pa < KERNBASE || pa >= KERNBASE + MEMORY_SIZE) && !IS_DEVICE_PA(pa)) {
 		panic("invalid phisical memory");
 	}
 	u_long vpn0 = VPN0(va);
@@ -835,9 +851,7 @@ int map_page(u_long *pgdir, u_int asid, u_long va, u_long pa, u_int perm) {
 					return 0;
 				} else {
 					// clear
-					if (--pa2page(original_pa)->pp_ref == 0) {
-						page_free(pa2page(original_pa));
-					}
+					pa_decref(original_pa);
 					goto map;
 				}
 			} else {
@@ -896,9 +910,7 @@ int alloc_page_user(u_long *pgdir, u_int asid, u_long va, u_int perm) {
 			if (*pte0 & PTE_V) {
 				u_long original_pa = PTE2PA(*pte0);
 				// clear
-				if (--pa2page(original_pa)->pp_ref == 0) {
-					page_free(pa2page(original_pa));
-				}
+				pa_decref(original_pa);
 				goto map;
 			} else {
 				goto map;
@@ -963,7 +975,7 @@ int map_page_user(u_long *pgdir, u_int asid, u_long va, u_long pa, u_int perm) {
 		panic("invalid perm: %08x", perm);
 	}
 
-	if ((pa < KERNBASE || pa >= KERNBASE + MEMORY_SIZE) && (pa < 0x10001000 || pa >= 0x10009000)) { 
+	if ((pa < KERNBASE || pa >= KERNBASE + MEMORY_SIZE) && !IS_DEVICE_PA(pa)) {
 		panic("invalid phisical memory");
 	}
 	u_long vpn0 = VPN0(va);
@@ -987,9 +999,7 @@ int map_page_user(u_long *pgdir, u_int asid, u_long va, u_long pa, u_int perm) {
 					return 0;
 				} else {
 					// clear
-					if (--pa2page(original_pa)->pp_ref == 0) {
-						page_free(pa2page(original_pa));
-					}
+					pa_decref(original_pa);
 					goto map;
 				}
 			} else {
@@ -1061,9 +1071,7 @@ int unmap_page(Pde *pgdir, u_int asid, u_long va) {
 				u_long original_pa = PTE2PA(*pte0);
 
 				// clear
-				if (--pa2page(original_pa)->pp_ref == 0) {
-					page_free(pa2page(original_pa));
-				}
+				pa_decref(original_pa);
 
 				// unmap(map at 0L)
 				tlb_invalidate(asid, va);
@@ -1127,9 +1135,7 @@ int destroy_pgdir(u_long *pgdir, u_int asid) {
 						u_long pa = PTE2PA(*pte0);
 
 						// clear
-						if (--pa2page(pa)->pp_ref == 0) {
-							page_free(pa2page(pa));
-						}
+						pa_decref(pa);
 
 						// unmap
 						tlb_invalidate(asid, va);
@@ -1421,9 +1427,7 @@ int alloc_page(u_long *pgdir, u_int asid, u_long va, u_int perm) {
 				if (*pte0 & PTE_V) {
 					u_long original_pa = PTE2PA(*pte0);
 					// clear
-					if (--pa2page(original_pa)->pp_ref == 0) {
-						page_free(pa2page(original_pa));
-					}
+					pa_decref(original_pa);
 					goto map;
 				} else {
 					goto map;
@@ -1478,7 +1482,7 @@ int map_page(u_long *pgdir, u_int asid, u_long va, u_long pa, u_int perm) {
 		panic("invalid perm: %08x", perm);
 	}
 
-	if ((pa < KERNBASE || pa >= KERNBASE + MEMORY_SIZE) && (pa < 0x10001000 || pa >= 0x10009000)) { 
+	if ((pa < KERNBASE || pa >= KERNBASE + MEMORY_SIZE) && !IS_DEVICE_PA(pa)) {
 		panic("invalid phisical memory");
 	}
 	u_long vpn0 = VPN0(va);
@@ -1507,9 +1511,7 @@ int map_page(u_long *pgdir, u_int asid, u_long va, u_long pa, u_int perm) {
 						return 0;
 					} else {
 						// clear
-						if (--pa2page(original_pa)->pp_ref == 0) {
-							page_free(pa2page(original_pa));
-						}
+						pa_decref(original_pa);
 						goto map;
 					}
 				} else {
@@ -1583,9 +1585,7 @@ int alloc_page_user(u_long *pgdir, u_int asid, u_long va, u_int perm) {
 				if (*pte0 & PTE_V) {
 					u_long original_pa = PTE2PA(*pte0);
 					// clear
-					if (--pa2page(original_pa)->pp_ref == 0) {
-						page_free(pa2page(original_pa));
-					}
+					pa_decref(original_pa);
 					goto map;
 				} else {
 					goto map;
@@ -1664,7 +1664,7 @@ int map_page_user(u_long *pgdir, u_int asid, u_long va, u_long pa, u_int perm) {
 		panic("invalid perm: %08x", perm);
 	}
 
-	if ((pa < KERNBASE || pa >= KERNBASE + MEMORY_SIZE) && (pa < 0x10001000 || pa >= 0x10009000)) { 
+	if ((pa < KERNBASE || pa >= KERNBASE + MEMORY_SIZE) && !IS_DEVICE_PA(pa)) {
 		panic("invalid phisical memory");
 	}
 	u_long vpn0 = VPN0(va);
@@ -1693,9 +1693,7 @@ int map_page_user(u_long *pgdir, u_int asid, u_long va, u_long pa, u_int perm) {
 						return 0;
 					} else {
 						// clear
-						if (--pa2page(original_pa)->pp_ref == 0) {
-							page_free(pa2page(original_pa));
-						}
+						pa_decref(original_pa);
 						goto map;
 					}
 				} else {
@@ -1779,9 +1777,7 @@ int unmap_page(Pde *pgdir, u_int asid, u_long va) {
 					u_long original_pa = PTE2PA(*pte0);
 
 					// clear
-					if (--pa2page(original_pa)->pp_ref == 0) {
-						page_free(pa2page(original_pa));
-					}
+					pa_decref(original_pa);
 
 					// unmap(map at 0L)
 					tlb_invalidate(asid, va);
@@ -1857,9 +1853,7 @@ int destroy_pgdir(u_long *pgdir, u_int asid) {
 								u_long pa = PTE2PA(*pte0);
 
 								// clear
-								if (--pa2page(pa)->pp_ref == 0) {
-									page_free(pa2page(pa));
-								}
+								pa_decref(pa);
 
 								// unmap
 								tlb_invalidate(asid, va);
@@ -4,9 +4,7 @@
 #include <trap.h>
 
 void outputk(void *data, const char *buf, size_t len) {
-	for (int i = 0; i < len; i++) {
-		printcharc(buf[i]);
-	}
+	printbufc(buf, len);
 }
 
 void printk(const char *fmt, ...) {
@@ -1,6 +1,10 @@
 #include <env.h>
 #include <pmap.h>
 #include <printk.h>
+#include <timer.h>
+#include <plic.h>
+#include <uart.h>
+#include <virtio.h>
 
 /* Overview:
  *   Implement a round-robin scheduling to select a runnable env and schedule it using 'env_run'.
@@ -57,31 +61,39 @@ void schedule(int yield) {
 	 *   'TAILQ_FIRST', 'TAILQ_REMOVE', 'TAILQ_INSERT_TAIL'
 	 */
 	/* Exercise 3.12: Your code here. */
+	timer_run();
+
 	count--;
 	// printk("count=%d\n", count);
-	if (yield || !count || !e) {
-		if (e) {
+	if (yield || !count || !e || e->env_status != ENV_RUNNABLE) {
+		// A blocked 'e' has already been removed from 'env_sched_list'.
+		if (e && e->env_status == ENV_RUNNABLE) {
 			TAILQ_REMOVE(&env_sched_list, e, env_sched_link);
-			if (e->env_status == ENV_RUNNABLE) {
-				TAILQ_INSERT_TAIL(&env_sched_list, e, env_sched_link);
+			TAILQ_INSERT_TAIL(&env_sched_list, e, env_sched_link);
+		}
+		// Nothing to run: halt until some sleeping env is woken up by its timer.
+		while (TAILQ_EMPTY(&env_sched_list)) {
+			int waiting = timer_pending() || uart_waiting();
+#if !defined(LAB) || LAB >= 4
+			waiting = waiting || virtio_busy();
+#endif
+			if (!waiting) {
+				panic("schedule: no runnable envs");
 			}
+			timer_idle();
+			plic_intr();
 		}
 		e = TAILQ_FIRST(&env_sched_list);
 		// printk("%08x: pc=%08x\n", e->env_id, e->env_tf.cp0_epc);
-		if (!e) {
-			panic("schedule: no runnable envs");
-		}
 		count = e->env_pri;
-	} else if (e->env_status != ENV_RUNNABLE) {
-		TAILQ_REMOVE(&env_sched_list, e, env_sched_link);
-		if (e->env_status == ENV_RUNNABLE) {
-			TAILQ_INSERT_TAIL(&env_sched_list, e, env_sched_link);
-		}
-		e = TAILQ_FIRST(&env_sched_list);
-		if (!e) {
-			panic("schedule: no runnable envs");
+
+		if (curenv && curenv != e) {
+			if (yield || curenv->env_status != ENV_RUNNABLE) {
+				curenv->env_stat.es_voluntary++;
+			} else {
+				curenv->env_stat.es_involuntary++;
+			}
 		}
-		count = e->env_pri;
 	}
 	env_run(e);
 
@@ -1,12 +1,15 @@
 #include <drivers/dev_cons.h>
 #include <env.h>
+#include <futex.h>
 #include <mmu.h>
 #include <pmap.h>
 #include <printk.h>
 #include <sched.h>
 #include <syscall.h>
+#include <uart.h>
 
 extern struct Env *curenv;
+extern struct Env envs[];
 
 /* Overview:
  * 	This function is used to print a character on screen.
@@ -26,50 +29,23 @@ void sys_putchar(int c) {
  * 	`s` is base address of the string, and `num` is length of the string.
  */
 int sys_print_cons(const void *s, u_long num) {
-	u_long pa = get_pa(&cur_pgdir, (u_long)s);
+	u_long va = (u_long)s;
 
-	if (/* ((u_long)pa + num) > UTOP || ((u_long)pa) >= UTOP || */ (pa > pa + num)) {
+	if (va + num < va) {
 		return -E_INVAL;
 	}
 
-	if (ROUNDDOWN((u_long)s, PAGE_SIZE) == ROUNDDOWN((u_long)s + num, PAGE_SIZE)) {
-		u_long i;
-		for (i = 0; i < num; i++) {
-			printcharc(((char *)pa)[i]);
+	// Print page by page. The characters are queued by the console driver, so this does not wait
+	// for them to be sent.
+	while (num > 0) {
+		u_long n = MIN(num, PAGE_SIZE - va % PAGE_SIZE);
+		if (!is_mapped_page(&cur_pgdir, va)) { // 6.18 防止缺页异常，但开销大，可以优化
+			alloc_page_user(&cur_pgdir, curenv->env_asid, va, PTE_R | PTE_W | PTE_U);
 		}
-		return 0;
-	}
-	
-	u_long remain = (u_long)s % PAGE_SIZE;
-	u_long i;
-	for (i = 0; i < remain; i++) {
-		printcharc(((char *)pa)[i]);
+		printbufc((const char *)get_pa(&cur_pgdir, va), n);
+		va += n;
+		num -= n;
 	}
-	num -= remain;
-	s += remain;
-	
-	while (num >= PAGE_SIZE) {
-		if (!is_mapped_page(&cur_pgdir, (u_long)s)) { // 6.18 防止缺页异常，但开销大，可以优化
-			alloc_page_user(&cur_pgdir, curenv->env_asid, (u_long)s, PTE_R | PTE_W | PTE_U);
-		}
-		pa = get_pa(&cur_pgdir, (u_long)s);
-		for (i = 0; i < PAGE_SIZE; i++) {
-			printcharc(((char *)pa)[i]);
-		}
-		num -= PAGE_SIZE;
-		s += PAGE_SIZE;
-	}
-
-	if (num) {
-		if (!is_mapped_page(&cur_pgdir, (u_long)s)) {
-			alloc_page_user(&cur_pgdir, curenv->env_asid, (u_long)s, PTE_R | PTE_W | PTE_U);
-		}
-		pa = get_pa(&cur_pgdir, (u_long)s);
-		for (i = 0; i < num; i++) {
-			printcharc(((char *)pa)[i]);
-		}
-	}
-
 	return 0;
 }
 
@@ -109,10 +85,11 @@ void __attribute__((noreturn)) sys_yield(void) {
  * or the caller itself.
  *
  * Post-Condition:
+ *  The environment exits with 'status', which is returned to envs waiting for it in 'sys_wait'.
  *  Returns 0 on success.
  *  Returns the original error if underlying calls fail.
  */
-int sys_env_destroy(u_long envid) {
+int sys_env_destroy(u_long envid, u_long status) {
 	struct Env *e;
 	try(envid2env(envid, &e, 1));
 
@@ -121,7 +98,7 @@ int sys_env_destroy(u_long envid) {
 	printk("[%08x] destroying %08x\n", curenv->env_id, e->env_id);
 	#endif
 	#endif
-	env_destroy(e);
+	env_destroy(e, status);
 	return 0;
 }
 
@@ -161,6 +138,34 @@ static inline int is_illegal_va_range(u_long va, u_long len) {
 	return va + len < va || va < UTEMP || va + len > UTOP;
 }
 
+/* Overview:
+ *   Copy 'len' bytes between the kernel buffer 'buf' and the user address 'va' of 'curenv', page
+ *   by page. Copy from user space if 'out' is 0, or to user space otherwise.
+ *
+ * Post-Condition:
+ *   Return 0 on success.
+ *   Return -E_INVAL if some page in the range is not mapped, or not writable when 'out' is set.
+ */
+static int copy_user(void *buf, u_long va, u_long len, int out) {
+	while (len > 0) {
+		u_long n = MIN(len, PAGE_SIZE - (va & (PAGE_SIZE - 1)));
+		u_long pa = get_pa(&cur_pgdir, va);
+
+		if (pa == (u_long)-1 || (out && !(get_perm(&cur_pgdir, va) & PTE_W))) {
+			return -E_INVAL;
+		}
+		if (out) {
+			memcpy((void *)pa, buf, n);
+		} else {
+			memcpy(buf, (void *)pa, n);
+		}
+		buf += n;
+		va += n;
+		len -= n;
+	}
+	return 0;
+}
+
 /* Overview:
  *   Allocate a physical page and map 'va' to it with 'perm' in the address space of 'envid'.
  *   If 'va' is already mapped, that original page is sliently unmapped.
@@ -252,6 +257,10 @@ int sys_mem_map(u_long srcid, u_long srcva, u_long dstid, u_long dstva, u_long p
 	}
 
 	u_long pa = get_pa(&srcenv->env_pgdir, srcva);
+	// Device registers are only mapped for the env they are granted to (see 'sys_dev_map').
+	if (IS_DEVICE_PA(pa)) {
+		return -E_INVAL;
+	}
 	// static int iii = 0;
 	// if (iii == 1) {
 	// 	printk("%016lx\n", dstenv->env_pgdir);
@@ -316,7 +325,8 @@ int sys_mem_unmap(u_long envid, u_long va) {
  *   - The new env's 'env_tf' is copied from the kernel stack, except for $v0 set to 0 to indicate
  *     the return value in child.
  *   - The new env's 'env_status' is set to 'ENV_NOT_RUNNABLE'.
- *   - The new env's 'env_pri' is copied from 'curenv'.
+ *   - The new env's 'env_pri' is copied from the base priority of 'curenv', so a priority lent to
+ *     'curenv' over IPC is not inherited.
  *   Returns the original error if underlying calls fail.
  *
  * Hint:
@@ -403,7 +413,8 @@ int sys_exofork(void) {
 	#endif
 
 	e->env_status = ENV_NOT_RUNNABLE;
-	e->env_pri = curenv->env_pri;
+	e->env_pri = curenv->env_base_pri;
+	e->env_base_pri = curenv->env_base_pri;
 
 	return e->env_id;
 }
@@ -437,8 +448,10 @@ int sys_set_env_status(u_long envid, u_long status) {
 	/* Exercise 4.14: Your code here. (3/3) */
 	if (env->env_status == ENV_RUNNABLE && status != ENV_RUNNABLE) {
 		TAILQ_REMOVE(&env_sched_list, env, env_sched_link);
+		env_stat_block(env); // blocked from now on, as in 'env_block'
 	} else if (env->env_status != ENV_RUNNABLE && status == ENV_RUNNABLE) {
 		TAILQ_INSERT_TAIL(&env_sched_list, env, env_sched_link);
+		env->env_stat_stamp = timer_now(); // starts waiting for the CPU from now on
 	}
 
 	/* Step 4: Set the 'env_status' of 'env'. */
@@ -496,19 +509,104 @@ void sys_panic(char *msg) {
 }
 
 /* Overview:
- *   Wait for a message (a value, together with a page if 'dstva' is not 0) from other envs.
- *   'curenv' is blocked until a message is sent.
+ *   Lend the priority of the sender 'from' to the receiver 'to' which has just been woken up by
+ *   its message, and put 'to' at the head of 'env_sched_list' so that it runs as soon as 'from'
+ *   blocks for the reply. This keeps a low-priority server from being starved by CPU hogs while
+ *   it serves a high-priority client.
+ *   The loan is paid back when 'to' replies to 'from' or waits for its next message.
+ */
+static void ipc_donate(struct Env *from, struct Env *to) {
+	if (from->env_pri > to->env_pri) {
+		to->env_pri = from->env_pri;
+		to->env_donor = from->env_id;
+		if (to->env_status == ENV_RUNNABLE) {
+			TAILQ_REMOVE(&env_sched_list, to, env_sched_link);
+			TAILQ_INSERT_HEAD(&env_sched_list, to, env_sched_link);
+		}
+	}
+}
+
+static void ipc_restore(struct Env *e) {
+	if (e->env_donor) {
+		e->env_pri = e->env_base_pri;
+		e->env_donor = 0;
+	}
+}
+
+/* Overview:
+ *   Deliver a message from 'from' to 'to', which must be receiving: set the ipc fields of 'to',
+ *   copy the words of 'msg' to its $a1..$a6, and if 'srcva' is not zero, map the 'npages'
+ *   contiguous pages at 'srcva' in 'from' to 'to->env_ipc_dstva', all with 'perm'. The value of
+ *   the message is 'msg[0]', and 'perm' is stored as is, being 0 for a register-carried message.
+ *   Neither env is woken up here.
  *
  * Post-Condition:
  *   Return 0 on success.
- *   Return -E_INVAL: 'dstva' is neither 0 nor a legal address.
+ *   Return -E_INVAL if 'srcva' is not zero and some of its pages are not mapped in 'from', or if
+ *   'npages' is larger than the window 'to->env_ipc_dstnpages'. 'to' is left untouched then.
+ *   Return the original error when underlying calls fail, 'to' being left receiving then.
  */
-int sys_ipc_recv(u_long dstva) {
-	/* Step 1: Check if 'dstva' is either zero or a legal address. */
-	if (dstva != 0 && is_illegal_va(dstva)) {
-		return -E_INVAL;
+static int ipc_deliver(struct Env *from, struct Env *to, const u_long *msg, u_long srcva,
+		       u_long npages, u_long perm) {
+	if (srcva != 0) {
+		// Validate the whole range before mapping anything.
+		if (npages > to->env_ipc_dstnpages) {
+			return -E_INVAL;
+		}
+		for (u_long i = 0; i < npages; i++) {
+			if (is_mapped_page(&from->env_pgdir, srcva + i * PAGE_SIZE) == 0) {
+				return -E_INVAL;
+			}
+		}
 	}
 
+	if (srcva != 0) {
+		for (u_long i = 0; i < npages; i++) {
+			u_long pa = get_pa(&from->env_pgdir, srcva + i * PAGE_SIZE);
+			// printk("ipc: %x: %016lx->%x: %016lx(%016lx)\n", to->env_id, to->env_ipc_dstva, from->env_id, srcva, pa);
+			try(map_page_user(&to->env_pgdir, to->env_asid, to->env_ipc_dstva + i * PAGE_SIZE,
+					  pa, perm));
+		}
+	}
+
+	to->env_ipc_value = msg[0];
+	to->env_ipc_from = from->env_id;
+	to->env_ipc_perm = perm;
+	to->env_ipc_recving = 0;
+	env_set_msg(to, msg);
+	return 0;
+}
+
+/* Overview:
+ *   Consume the pending notification bits of 'e' in 'mask', 'e' being receiving, as a message
+ *   from envid 0 with the bits as its value and no page.
+ */
+static void ipc_take_notify(struct Env *e, u_int mask) {
+	u_long msg[IPC_MSG_WORDS] = {e->env_notify & mask};
+
+	e->env_notify &= ~mask;
+	e->env_ipc_value = msg[0];
+	e->env_ipc_from = 0;
+	e->env_ipc_perm = 0;
+	e->env_ipc_recving = 0;
+	env_set_msg(e, msg);
+}
+
+/* Overview:
+ *   Make 'curenv' receive at 'dstva', and take the message of the first env blocked in
+ *   'sys_ipc_send' or 'sys_ipc_call' to 'curenv' if there is one. A sender is woken up, while a
+ *   caller stays blocked for the reply, which only 'curenv' may send (see 'env_ipc_callee').
+ *   Pending notification bits in 'notify' are taken first.
+ *
+ * Post-Condition:
+ *   Return 1 if a message is received, or 0 if 'curenv' has to block for one.
+ */
+static int ipc_recv_queued(u_long dstva, u_int notify) {
+	struct Env *sender;
+
+	/* The request being served (if any) is done, give back the lent priority. */
+	ipc_restore(curenv);
+
 	/* Step 2: Set 'curenv->env_ipc_recving' to 1. */
 	/* Exercise 4.8: Your code here. (1/8) */
 	curenv->env_ipc_recving = 1;
@@ -516,15 +614,66 @@ int sys_ipc_recv(u_long dstva) {
 	/* Step 3: Set the value of 'curenv->env_ipc_dstva'. */
 	/* Exercise 4.8: Your code here. (2/8) */
 	curenv->env_ipc_dstva = dstva;
+	curenv->env_ipc_dstnpages = 1;
+
+	/* A pending notification is received as a message from envid 0. */
+	if (curenv->env_notify & notify) {
+		ipc_take_notify(curenv, notify);
+		return 1;
+	}
+
+	/* Take the message of the first blocked sender without going through the scheduler. */
+	while ((sender = env_wait_dequeue(&curenv->env_ipc_senders)) != NULL) {
+		int r = ipc_deliver(sender, curenv, sender->env_ipc_send_msg,
+				    sender->env_ipc_send_srcva, 1, sender->env_ipc_send_perm);
+		if (r == 0 && sender->env_ipc_calling) {
+			sender->env_ipc_calling = 0;
+			sender->env_ipc_recving = 1;
+			sender->env_ipc_callee = curenv->env_id;
+			env_wait(sender, &curenv->env_ipc_callers);
+		} else {
+			env_wakeup(sender, r);
+		}
+		if (r == 0) {
+			ipc_donate(sender, curenv);
+			return 1;
+		}
+	}
+	curenv->env_notify_mask = notify;
+	return 0;
+}
+
+/* Overview:
+ *   Wait for a message (a value, together with a page if 'dstva' is not 0) from other envs.
+ *   If some envs are blocked in 'sys_ipc_send' to 'curenv', the first of them is received at once
+ *   and woken up. Otherwise 'curenv' is blocked until a message is sent, or until 'timeout'
+ *   nanoseconds have passed if 'timeout' is not 0.
+ *   Notification bits in 'notify' (see 'sys_notify') are also received, as a message from envid 0
+ *   whose value is the bits taken.
+ *
+ * Post-Condition:
+ *   Return 0 on success.
+ *   Return -E_INVAL: 'dstva' is neither 0 nor a legal address, or 'notify' is not within
+ *   'NOTIFY_ALL'.
+ *   Return -E_TIMEOUT: no message is received in 'timeout' nanoseconds.
+ */
+int sys_ipc_recv(u_long dstva, u_long timeout, u_long notify) {
+	/* Step 1: Check if 'dstva' is either zero or a legal address. */
+	if ((dstva != 0 && is_illegal_va(dstva)) || (notify & ~NOTIFY_ALL)) {
+		return -E_INVAL;
+	}
+
+	if (ipc_recv_queued(dstva, notify)) {
+		return 0;
+	}
 
 	/* Step 4: Set the status of 'curenv' to 'ENV_NOT_RUNNABLE' and remove it from
 	 * 'env_sched_list'. */
 	/* Exercise 4.8: Your code here. (3/8) */
-	curenv->env_status = ENV_NOT_RUNNABLE;
-	TAILQ_REMOVE(&env_sched_list, curenv, env_sched_link);
+	env_block(curenv, timeout ? timer_now() + ns2cycles(timeout) : TIMER_NEVER);
+	curenv->env_stat_ipc = 1;
 
 	/* Step 5: Give up the CPU and block until a message is received. */
-	((struct Trapframe *)KSTACKTOP - 1)->regs[10] = 0;
 	schedule(1);
 }
 
@@ -541,12 +690,12 @@ int sys_ipc_recv(u_long dstva) {
  *     with 'perm'.
  *
  *   Return -E_IPC_NOT_RECV if the target has not been waiting for an IPC message with
- *   'sys_ipc_recv'.
+ *   'sys_ipc_recv', e.g. it is waiting for the reply to its 'sys_ipc_call'.
  *   Return the original error when underlying calls fail.
  */
 int sys_ipc_try_send(u_long envid, u_long value, u_long srcva, u_long perm) {
 	struct Env *e;
-	// struct Page *p;
+	u_long msg[IPC_MSG_WORDS] = {value};
 
 	/* Step 1: Check if 'srcva' is either zero or a legal address. */
 	/* Exercise 4.8: Your code here. (4/8) */
@@ -562,58 +711,260 @@ int sys_ipc_try_send(u_long envid, u_long value, u_long srcva, u_long perm) {
 
 	/* Step 3: Check if the target is waiting for a message. */
 	/* Exercise 4.8: Your code here. (6/8) */
-	if (!e->env_ipc_recving) {
+	/* A caller waits for the reply of its callee only (see 'sys_ipc_reply_recv'). */
+	if (!e->env_ipc_recving || e->env_ipc_callee != 0) {
 		return -E_IPC_NOT_RECV;
 	}
 
-	/* Step 4: Set the target's ipc fields. */
-	e->env_ipc_value = value;
-	e->env_ipc_from = curenv->env_id;
-	e->env_ipc_perm = PTE_V | perm;
-	e->env_ipc_recving = 0;
+	/* Step 4: Set the target's ipc fields and map the page (see 'ipc_deliver'). */
+	try(ipc_deliver(curenv, e, msg, srcva, 1, PTE_V | perm));
 
 	/* Step 5: Set the target's status to 'ENV_RUNNABLE' again and insert it to the tail of
-	 * 'env_sched_list'. */
+	 * 'env_sched_list'. This also cancels the timeout of its 'sys_ipc_recv'. */
 	/* Exercise 4.8: Your code here. (7/8) */
-	e->env_status = ENV_RUNNABLE;
-	TAILQ_INSERT_TAIL(&env_sched_list, e, env_sched_link);
+	env_wakeup(e, 0);
 
-	/* Step 6: If 'srcva' is not zero, map the page at 'srcva' in 'curenv' to 'e->env_ipc_dstva'
-	 * in 'e'. */
-	/* Return -E_INVAL if 'srcva' is not zero and not mapped in 'curenv'. */
-	if (srcva != 0) {
-		/* Exercise 4.8: Your code here. (8/8) */	
-		// if ((p = page_lookup(cur_pgdir, srcva, 0)) == NULL) {
-		// 	return -E_INVAL;
-		// }
-		// page_insert(e->env_pgdir, e->env_asid, p, e->env_ipc_dstva, perm);
+	/* A reply to the donor pays the priority back, while a request lends it. */
+	if (curenv->env_donor == e->env_id) {
+		ipc_restore(curenv);
+	}
+	ipc_donate(curenv, e);
+	return 0;
+}
 
-		if (is_mapped_page(&cur_pgdir, srcva) == 0) {
-			return -E_INVAL;
-		}
+/* Overview:
+ *   Save the message of 'e' (a 'value', together with a page if 'srcva' is not 0) to be taken by
+ *   'ipc_recv_queued'.
+ */
+static void ipc_queue_send(struct Env *e, u_long value, u_long srcva, u_long perm) {
+	memset(e->env_ipc_send_msg, 0, sizeof(e->env_ipc_send_msg));
+	e->env_ipc_send_msg[0] = value;
+	e->env_ipc_send_srcva = srcva;
+	e->env_ipc_send_perm = PTE_V | perm;
+}
 
-		u_long pa = get_pa(&cur_pgdir, srcva);
+/* Overview:
+ *   Send a 'value' (together with a page if 'srcva' is not 0) to the target env 'envid',
+ *   blocking until it is received.
+ *   If the target is not receiving, or is waiting for the reply to its 'sys_ipc_call', 'curenv' is
+ *   appended to its FIFO of senders, which 'sys_ipc_recv' takes from in order.
+ *
+ * Post-Condition:
+ *   Return 0 once the message is received.
+ *   Return -E_INVAL if 'srcva' is illegal or not mapped, or if 'envid' is 'curenv'.
+ *   Return -E_BAD_ENV if the target is destroyed before receiving the message.
+ *   Return the original error when underlying calls fail.
+ */
+int sys_ipc_send(u_long envid, u_long value, u_long srcva, u_long perm) {
+	struct Env *e;
 
-		/* Step 5: Map the physical page at 'dstva' in the address space of 'dstid'. */
-		// return page_insert(dstenv->env_pgdir, dstenv->env_asid, pp, dstva, perm);
-		// printk("ipc: %x: %016lx->%x: %016lx(%016lx)\n", e->env_id, e->env_ipc_dstva, curenv->env_id, srcva, pa);
-		return map_page_user(&e->env_pgdir, e->env_asid, e->env_ipc_dstva, pa, perm);
+	if (srcva != 0 && is_illegal_va(srcva)) {
+		return -E_INVAL;
+	}
+	try(envid2env(envid, &e, 0));
+
+	if (e->env_ipc_recving && e->env_ipc_callee == 0) {
+		return sys_ipc_try_send(envid, value, srcva, perm);
+	}
+
+	if (e == curenv || (srcva != 0 && is_mapped_page(&cur_pgdir, srcva) == 0)) {
+		return -E_INVAL;
+	}
+
+	ipc_queue_send(curenv, value, srcva, perm);
+	env_block(curenv, TIMER_NEVER);
+	curenv->env_stat_ipc = 1;
+	env_wait(curenv, &e->env_ipc_senders);
+
+	/* The target is busy, and possibly serving someone less important than us. */
+	ipc_donate(curenv, e);
+	schedule(1);
+}
+
+/* Overview:
+ *   OR the notification 'bits' into those pending at 'envid' without blocking, like ringing a
+ *   doorbell. The meaning of each bit is up to the target. A bit does not count how many times
+ *   it is posted: it is pending until taken by 'sys_notify_wait', or by 'sys_ipc_recv' (as a
+ *   message from envid 0) if the bit is asked for. A target blocked waiting for any of the bits is woken
+ *   up at once.
+ *
+ * Post-Condition:
+ *   Return 0 on success.
+ *   Return -E_INVAL if 'bits' is not within 'NOTIFY_ALL'.
+ *   Return the original error of 'envid2env'.
+ */
+int sys_notify(u_long envid, u_long bits) {
+	struct Env *e;
 
+	if (bits & ~NOTIFY_ALL) {
+		return -E_INVAL;
 	}
+	try(envid2env(envid, &e, 0));
+	env_notify(e, bits);
 	return 0;
 }
 
-// XXX: kernel does busy waiting here, blocking all envs
+/* Overview:
+ *   Post the notification 'bits' to 'e', as 'sys_notify' does. Also used by the kernel to deliver
+ *   device interrupts.
+ */
+void env_notify(struct Env *e, u_int bits) {
+	e->env_notify |= bits;
+	if (e->env_notify & e->env_notify_mask) {
+		if (e->env_ipc_recving) {
+			ipc_take_notify(e, e->env_notify_mask);
+			env_wakeup(e, 0);
+		} else {
+			u_int taken = e->env_notify & e->env_notify_mask;
+			e->env_notify &= ~taken;
+			env_wakeup(e, taken);
+		}
+	}
+}
+
+/* Overview:
+ *   Take the pending notification bits of 'curenv' in 'mask', blocking until any of them is
+ *   posted by 'sys_notify'. Other bits are left pending.
+ *
+ * Post-Condition:
+ *   Return the bits taken.
+ *   Return -E_INVAL if 'mask' is 0 or not within 'NOTIFY_ALL'.
+ */
+int sys_notify_wait(u_long mask) {
+	u_int taken = curenv->env_notify & mask;
+
+	if (mask == 0 || (mask & ~NOTIFY_ALL)) {
+		return -E_INVAL;
+	}
+	if (taken) {
+		curenv->env_notify &= ~taken;
+		return taken;
+	}
+	curenv->env_notify_mask = mask;
+	env_block(curenv, TIMER_NEVER);
+	schedule(1);
+}
+
+/* Overview:
+ *   Block 'curenv' until the env 'envid' exits, and return its exit status. Any env may be waited
+ *   for. The status of an env already exited is kept until its slot in 'envs' is reused.
+ *
+ * Post-Condition:
+ *   Return the exit status of 'envid' (never negative, see 'EXIT_STATUS_MASK').
+ *   Return -E_INVAL if 'envid' is 0 or 'curenv' itself.
+ *   Return -E_BAD_ENV if 'envid' is unknown, or its slot has been reused.
+ */
+int sys_wait(u_long envid) {
+	struct Env *e = &envs[ENVX(envid)];
+
+	if (envid == 0 || e == curenv) {
+		return -E_INVAL;
+	}
+	if (e->env_id != envid) {
+		return -E_BAD_ENV;
+	}
+	if (e->env_status == ENV_FREE) {
+		return e->env_exit_status;
+	}
+	env_block(curenv, TIMER_NEVER);
+	env_wait(curenv, &e->env_exit_waiters);
+	schedule(1);
+}
+
+/* Overview:
+ *   Translate the address of a futex word 'va' of 'curenv' to its physical address, which is the
+ *   key of the futex, so that envs sharing a page meet even if it is mapped at different addresses.
+ *
+ * Post-Condition:
+ *   Return the physical address, or (u_long)-1 if 'va' is illegal, unaligned or not mapped.
+ */
+static u_long futex_pa(u_long va) {
+	if (is_illegal_va_range(va, sizeof(u_int)) || va % sizeof(u_int) != 0) {
+		return -1;
+	}
+	return get_pa(&cur_pgdir, va);
+}
+
+/* Overview:
+ *   Block 'curenv' until 'sys_futex_wake' is called on the word at 'va', if it still holds
+ *   'expected'. The check and the blocking are done atomically, so a wakeup after the caller saw
+ *   the old value is never lost. 'timeout' (in ns) limits the time blocked unless it is 0.
+ *
+ * Post-Condition:
+ *   Return 0 when woken up.
+ *   Return -E_AGAIN if the word does not hold 'expected'.
+ *   Return -E_TIMEOUT if not woken up within 'timeout'.
+ *   Return -E_INVAL if 'va' is illegal, unaligned or not mapped.
+ */
+int sys_futex_wait(u_long va, u_long expected, u_long timeout) {
+	u_long pa = futex_pa(va);
+
+	if (pa == (u_long)-1) {
+		return -E_INVAL;
+	}
+	if (*(volatile u_int *)pa != (u_int)expected) {
+		return -E_AGAIN;
+	}
+	env_block(curenv, timeout ? timer_now() + ns2cycles(timeout) : TIMER_NEVER);
+	futex_wait(curenv, pa);
+	schedule(1);
+}
+
+/* Overview:
+ *   Store 'val' into the word at 'va', and wake up at most 'n' envs blocked in 'sys_futex_wait'
+ *   on it. As both are done in the kernel, an env about to wait for the old value cannot block
+ *   after the wakeup, even if it was checking other state that changes within the same
+ *   'sys_batch' (e.g. a page unmapped after the wakeup).
+ *
+ * Post-Condition:
+ *   Return the number of envs woken up.
+ *   Return -E_INVAL if 'va' is illegal, unaligned, not mapped or not writable.
+ */
+int sys_futex_wake(u_long va, u_long n, u_long val) {
+	u_long pa = futex_pa(va);
+
+	if (pa == (u_long)-1 || !(get_perm(&cur_pgdir, va) & PTE_W)) {
+		return -E_INVAL;
+	}
+	*(volatile u_int *)pa = val;
+	return futex_wake(pa, n);
+}
+
+/* Overview:
+ *   Read a character from the console, blocking 'curenv' until one is received by 'uart_intr'.
+ *   Other envs keep running meanwhile.
+ *
+ * Post-Condition:
+ *   Return the character.
+ */
 int sys_cgetc(void) {
-	int ch;
-	while ((ch = scancharc()) == 255) { // 把 0 改成 255，这是因为 sbi 规定没有输入返回 255
+	int ch = uart_getc();
+
+	if (ch >= 0) {
+		return ch;
 	}
-	return ch;
+	env_block(curenv, TIMER_NEVER);
+	uart_wait(curenv);
+	schedule(1);
+}
+
+/* Overview:
+ *   Check a device access of 'len' bytes at 'pa' from the user buffer at 'va' for 'sys_write_dev'
+ *   and 'sys_read_dev'. Only the registers of devices granted to 'curenv' (see 'sys_dev_map') are
+ *   accessible, one naturally aligned register of 1, 2, 4 or 8 bytes at a time.
+ */
+static int dev_check(u_long va, u_long pa, u_long len) {
+	if (is_illegal_va_range(va, len) || (len != 1 && len != 2 && len != 4 && len != 8) ||
+	    pa % len != 0 || !virtio_granted(curenv, pa)) {
+		return -E_INVAL;
+	}
+	return 0;
 }
 
 /* Overview:
  *  This function is used to write data at 'va' with length 'len' to a device physical address
- *  'pa'. Remember to check the validity of 'va' and 'pa' (see Hint below);
+ *  'pa'. The register is written with a single access of 'len' bytes, since memcpy may split
+ *  it into bytes, which virtio-mmio does not accept.
  *
  *  'va' is the starting address of source data, 'len' is the
  *  length of data (in bytes), 'pa' is the physical address of
@@ -622,131 +973,424 @@ int sys_cgetc(void) {
  * Post-Condition:
  *  Data within [va, va+len) is copied to the physical address 'pa'.
  *  Return 0 on success.
- *  Return -E_INVAL on bad address.
+ *  Return -E_INVAL on bad address (see 'dev_check').
  *
- * Hint: Use the unmapped and uncached segment in kernel address space (KSEG1) to perform MMIO.
- * Hint: You can use 'is_illegal_va_range' to validate 'va'.
- * Hint: You MUST use 'memcpy' to copy data after checking the validity.
- *
- *  All valid device and their physical address ranges:
- *	* ---------------------------------*
- *	|   device   | start addr | length |
- *	* -----------+------------+--------*
- *	|  console   | 0x10000000 | 0x20   | (dev_cons.h)
- *	|  IDE disk  | 0x13000000 | 0x4200 | (dev_disk.h)
- *	|    rtc     | 0x15000000 | 0x200  | (dev_rtc.h)
- *	* ---------------------------------*
+ *  Devices are accessed at 'pa + DEVOFFSET' in the kernel (see 'env_init').
  */
 int sys_write_dev(u_long va, u_long pa, u_long len) {
-	/* Exercise 5.1: Your code here. (1/2) */
-
+	uint64_t val = 0;
+
+	try(dev_check(va, pa, len));
+	try(copy_user(&val, va, len, 0));
+	switch (len) {
+	case 1:
+		*(volatile uint8_t *)(pa + DEVOFFSET) = val;
+		break;
+	case 2:
+		*(volatile uint16_t *)(pa + DEVOFFSET) = val;
+		break;
+	case 4:
+		*(volatile uint32_t *)(pa + DEVOFFSET) = val;
+		break;
+	default:
+		*(volatile uint64_t *)(pa + DEVOFFSET) = val;
+		break;
+	}
 	return 0;
 }
 
 /* Overview:
  *  This function is used to read data from a device physical address.
- *  Remember to check the validity of addresses (same as in 'sys_write_dev').
+ *  The addresses are checked as in 'sys_write_dev'.
  *
  * Post-Condition:
  *  Data at 'pa' is copied from device to [va, va+len).
  *  Return 0 on success.
  *  Return -E_INVAL on bad address.
- *
- * Hint: You MUST use 'memcpy' to copy data after checking the validity.
  */
 int sys_read_dev(u_long va, u_long pa, u_long len) {
-	/* Exercise 5.1: Your code here. (2/2) */
+	uint64_t val;
+
+	try(dev_check(va, pa, len));
+	switch (len) {
+	case 1:
+		val = *(volatile uint8_t *)(pa + DEVOFFSET);
+		break;
+	case 2:
+		val = *(volatile uint16_t *)(pa + DEVOFFSET);
+		break;
+	case 4:
+		val = *(volatile uint32_t *)(pa + DEVOFFSET);
+		break;
+	default:
+		val = *(volatile uint64_t *)(pa + DEVOFFSET);
+		break;
+	}
+	return copy_user(&val, va, len, 1);
+}
 
-	return 0;
+/* Overview:
+ *   Let 'curenv' drive the virtio-mmio device in 'slot' (0 to 'VIRTIO_NDEV' - 1) itself: map its
+ *   registers at 'va', and post its interrupts to 'curenv' as the notification 'bits', already
+ *   acknowledged at the device. DMA addresses are found from the page table of 'curenv' (see
+ *   'va2pa' in user/include/lib.h).
+ *   If the device is a disk driven by the kernel, the kernel hands it over, and the block
+ *   syscalls on it fail since. The device is reset when 'curenv' is freed.
+ *
+ *   The device may write any memory, so it is only granted to the fs server (see
+ *   'virtio_trusted').
+ *
+ * Post-Condition:
+ *   Return 0 on success.
+ *   Return -E_PERM if 'curenv' is not the fs server.
+ *   Return -E_INVAL if 'va' is illegal or not page aligned, 'bits' is not within 'NOTIFY_ALL',
+ *   or the device is not available (see 'virtio_grant').
+ */
+int sys_dev_map(u_long slot, u_long va, u_long bits) {
+	if (is_illegal_va(va) || va % PAGE_SIZE != 0 || (bits & ~NOTIFY_ALL)) {
+		return -E_INVAL;
+	}
+	try(virtio_grant(curenv, slot, bits));
+	return map_page_user(&cur_pgdir, curenv->env_asid, va, VIRTIO_BASE + slot * PAGE_SIZE,
+			     PTE_R | PTE_W | PTE_U);
 }
 
 #include <virtio.h>
 
-int sys_read_sector(u_long va, le64 sector) {
-	if (!is_mapped_page(&cur_pgdir, va)) {
-		alloc_page(&cur_pgdir, curenv->env_asid, va, PTE_R | PTE_W | PTE_U);
+/* Overview:
+ *   Describe the 'len' bytes at 'va' in the address space of 'curenv' by physically contiguous
+ *   segments of 'r', allocating the pages not mapped yet. Pages which happen to be physically
+ *   adjacent share a segment. If 'out' is set, the device writes the pages, so they must be
+ *   writable.
+ */
+static int vblk_user_segs(struct Vblk_req *r, u_long va, u_long len, int out) {
+	if (is_illegal_va_range(va, len)) {
+		return -E_INVAL;
 	}
-	u_long pa = get_pa(&cur_pgdir, va);
-	
-	if (va >> VPN0_SHIFT != (va + SECTOR_SIZE - 1) >> VPN0_SHIFT) {
-		u_long offset = (va &~ (PAGE_SIZE - 1)) + PAGE_SIZE - va;
-		if (!is_mapped_page(&cur_pgdir, va + SECTOR_SIZE)) {
-			alloc_page(&cur_pgdir, curenv->env_asid, va + SECTOR_SIZE, PTE_R | PTE_W | PTE_U);
+	r->r_nseg = 0;
+	while (len > 0) {
+		u_long n = MIN(len, PAGE_SIZE - va % PAGE_SIZE);
+		if (!is_mapped_page(&cur_pgdir, va)) {
+			try(alloc_page(&cur_pgdir, curenv->env_asid, va, PTE_R | PTE_W | PTE_U));
+		}
+		if (out && !(get_perm(&cur_pgdir, va) & PTE_W)) {
+			return -E_INVAL;
 		}
-		u_long pa_end = get_pa(&cur_pgdir, va + SECTOR_SIZE);
+		u_long pa = get_pa(&cur_pgdir, va);
+		if (r->r_nseg > 0 && r->r_seg[r->r_nseg - 1].pa + r->r_seg[r->r_nseg - 1].len == pa) {
+			r->r_seg[r->r_nseg - 1].len += n;
+		} else {
+			r->r_seg[r->r_nseg].pa = pa;
+			r->r_seg[r->r_nseg].len = n;
+			r->r_nseg++;
+		}
+		va += n;
+		len -= n;
+	}
+	return 0;
+}
 
-		u_long diskva = 0xb0008000;
-		struct Virtio *disk = (struct Virtio *)diskva;
-		read_sector(disk, sector);
+/* Overview:
+ *   Submit a request of 'type' for 'nsecs' sectors from 'sector' of disk 'disk', with the sectors
+ *   at 'va' as its data, and block 'curenv' until the disk completes it. The device reads or
+ *   writes the pages of 'curenv' directly.
+ *
+ * Post-Condition:
+ *   Return 0 on success, or -E_IO if the disk fails the request.
+ *   Return -E_INVAL if 'nsecs' is more than 'VBLK_MAX_SECTS', on bad address, if there is no such
+ *   disk or the sectors are beyond its end, or if the disk has been handed over to an env (see
+ *   'sys_dev_map').
+ */
+static int vblk_rw(u_int disk, u_int type, u_long va, le64 sector, u_int nsecs) {
+	struct Vblk_req *req;
+	int ret;
 
-		memcpy((void *)pa, (void *)&read_buffer.data, offset);
-		memcpy((void *)pa_end - SECTOR_SIZE + offset, (void *)((u_long)&read_buffer.data + offset), SECTOR_SIZE - offset);
+	if (nsecs > VBLK_MAX_SECTS) {
+		return -E_INVAL;
+	}
+	req = vblk_req_get(curenv);
+	req->r_disk = disk;
+	req->r_hdr.type = type;
+	req->r_hdr.reserved = 0;
+	req->r_hdr.sector = sector;
+	req->r_nseg = 0;
+	if (nsecs > 0) {
+		try(vblk_user_segs(req, va, nsecs * SECTOR_SIZE, type == VIRTIO_BLK_T_IN));
+	}
 
-		if (read_buffer.status != 0) {
-			panic("Write sector failed!");
-		}
-		return 0;
+	// Interrupts are off in the kernel, so the request cannot complete before we block.
+	if ((ret = vblk_submit(req)) <= 0) {
+		return ret;
 	}
+	env_block(curenv, TIMER_NEVER);
+	schedule(1);
+}
+
+int sys_read_sector(u_int disk, u_long va, le64 sector, u_int nsecs) {
+	return vblk_rw(disk, VIRTIO_BLK_T_IN, va, sector, nsecs);
+}
 
-	u_long diskva = 0xb0008000;
-	struct Virtio *disk = (struct Virtio *)diskva;
-	read_sector(disk, sector);
+int sys_write_sector(u_int disk, u_long va, le64 sector, u_int nsecs) {
+	return vblk_rw(disk, VIRTIO_BLK_T_OUT, va, sector, nsecs);
+}
+
+int sys_flush(u_int disk) {
+	return vblk_rw(disk, VIRTIO_BLK_T_FLUSH, 0, 0, 0);
+}
+
+/* Overview:
+ *   Store the virtio-mmio slot and the capacity of disk 'disk' (counting from 0, in the order of
+ *   the '-device' options of QEMU) into 'info' of 'curenv'. It is still known after the disk is
+ *   handed over to an env.
+ *
+ * Post-Condition:
+ *   Return 0 on success, or -E_INVAL if there is no such disk or on bad address.
+ */
+int sys_disk_info(u_int disk, u_long info) {
+	struct Disk_info di;
 
-	memcpy((void *)pa, (void *)&read_buffer.data, SECTOR_SIZE);
+	try(vblk_info(disk, &di));
+	return copy_user(&di, info, sizeof(di), 1);
+}
 
-	if (read_buffer.status != 0) {
-		panic("Write sector failed!");
+/* Overview:
+ *   Block 'curenv' for at least 'ns' nanoseconds. The CPU is given to other envs in the meantime,
+ *   and idles if there is none.
+ *
+ * Post-Condition:
+ *   Return 0 when the time is up.
+ */
+int sys_sleep(u_long ns) {
+	if (ns == 0) {
+		((struct Trapframe *)KSTACKTOP - 1)->regs[10] = 0;
+		schedule(1);
 	}
-	return 0;
+	env_block(curenv, timer_now() + ns2cycles(ns));
+	schedule(1);
 }
 
-int sys_write_sector(u_long va, le64 sector) {
-	if (!is_mapped_page(&cur_pgdir, va)) {
-		alloc_page(&cur_pgdir, curenv->env_asid, va, PTE_R | PTE_W | PTE_U);
+/* Overview:
+ *   Send the request 'msg' (with the page at 'srcva' if not 0) to 'e' and block 'curenv' until
+ *   the reply (of up to 'dstnpages' pages) is received at 'dstva'. 'perm' is as in 'ipc_deliver'.
+ *   If 'e' is already receiving, the CPU is handed over to it directly.
+ */
+static int ipc_call(struct Env *e, const u_long *msg, u_long srcva, u_long perm, u_long dstva,
+		    u_long dstnpages) {
+	if (e->env_ipc_recving && e->env_ipc_callee == 0) {
+		try(ipc_deliver(curenv, e, msg, srcva, 1, perm));
+		curenv->env_ipc_recving = 1;
+		curenv->env_ipc_callee = e->env_id;
+		curenv->env_ipc_dstva = dstva;
+		curenv->env_ipc_dstnpages = dstnpages;
+		env_block(curenv, TIMER_NEVER);
+		curenv->env_stat_ipc = 1;
+		env_wait(curenv, &e->env_ipc_callers);
+		env_wakeup(e, 0);
+		ipc_donate(curenv, e);
+
+		curenv->env_stat.es_voluntary++;
+		env_run(e);
 	}
-	u_long pa = get_pa(&cur_pgdir, va);
 
-	if (va >> VPN0_SHIFT != (va + SECTOR_SIZE - 1) >> VPN0_SHIFT) {
-		u_long offset = (va &~ (PAGE_SIZE - 1)) + PAGE_SIZE - va;
-		if (!is_mapped_page(&cur_pgdir, va + SECTOR_SIZE)) {
-			alloc_page(&cur_pgdir, curenv->env_asid, va + SECTOR_SIZE, PTE_R | PTE_W | PTE_U);
-		}
-		u_long pa_end = get_pa(&cur_pgdir, va + SECTOR_SIZE);
+	/* The target is busy: queue up like 'sys_ipc_send', and wait for the reply once received. */
+	memcpy(curenv->env_ipc_send_msg, msg, sizeof(curenv->env_ipc_send_msg));
+	curenv->env_ipc_send_srcva = srcva;
+	curenv->env_ipc_send_perm = perm;
+	curenv->env_ipc_dstva = dstva;
+	curenv->env_ipc_dstnpages = dstnpages;
+	env_block(curenv, TIMER_NEVER);
+	curenv->env_stat_ipc = 1;
+	env_wait(curenv, &e->env_ipc_senders);
+	curenv->env_ipc_calling = 1;
+	ipc_donate(curenv, e);
+	schedule(1);
+}
 
-		memcpy((void *)&write_buffer.data, (void *)pa, offset);
-		memcpy((void *)((u_long)&write_buffer.data + offset), (void *)pa_end - SECTOR_SIZE + offset, SECTOR_SIZE - offset);
+/* Overview:
+ *   Send a request (a 'value', together with a page if 'srcva' is not 0) to 'envid' and block
+ *   until its reply is received at 'dstva', like 'sys_ipc_send' followed by 'sys_ipc_recv'.
+ *   The reply may carry a range of up to 'dstnpages' pages (at least 1), mapped from 'dstva' on.
+ *   If the target is already receiving, the CPU is handed over to it directly, with the rest of
+ *   the time slice of 'curenv', instead of going through 'schedule'.
+ *
+ * Post-Condition:
+ *   Return 0 once the reply is received, which is read from 'env_ipc_*' like 'sys_ipc_recv'.
+ *   Only the target may reply, with 'sys_ipc_reply_recv'.
+ *   Return -E_INVAL if 'srcva' or 'dstva' is illegal, 'srcva' is not mapped, or 'envid' is
+ *   'curenv'.
+ *   Return -E_BAD_ENV if the target is destroyed before replying.
+ *   Return the original error when underlying calls fail.
+ */
+int sys_ipc_call(u_long envid, u_long value, u_long srcva, u_long perm, u_long dstva,
+		 u_long dstnpages) {
+	struct Env *e;
+	u_long msg[IPC_MSG_WORDS] = {value};
 
-		u_long diskva = 0xb0008000;
-		struct Virtio *disk = (struct Virtio *)diskva;
-		write_sector(disk, sector);
+	if (dstnpages == 0) {
+		dstnpages = 1;
+	}
+	if ((srcva != 0 && is_illegal_va(srcva)) || dstnpages > UTOP / PAGE_SIZE ||
+	    (dstva != 0 && is_illegal_va_range(dstva, dstnpages * PAGE_SIZE))) {
+		return -E_INVAL;
+	}
+	try(envid2env(envid, &e, 0));
+	if (e == curenv || (srcva != 0 && is_mapped_page(&cur_pgdir, srcva) == 0)) {
+		return -E_INVAL;
+	}
+	return ipc_call(e, msg, srcva, PTE_V | perm, dstva, dstnpages);
+}
 
-		if (write_buffer.status != 0) {
-			panic("Write sector failed!");
-		}
+/* Overview:
+ *   Like 'sys_ipc_call', but the request is a message of 'IPC_MSG_WORDS' words passed in
+ *   $a1..$a6, with the target envid in $a7. No page is sent or received, and the receiver gets the
+ *   words in its own $a1..$a6 with 'env_ipc_perm' set to 0. The words of the reply are returned
+ *   in $a1..$a6 of 'curenv' in the same way.
+ *
+ * Post-Condition:
+ *   Return 0 once the reply is received.
+ *   Return -E_INVAL if the target is 'curenv'.
+ *   Return -E_BAD_ENV if the target is destroyed before replying.
+ */
+int sys_ipc_call_msg(void) {
+	struct Trapframe *tf = (struct Trapframe *)KSTACKTOP - 1;
+	struct Env *e;
+
+	try(envid2env(tf->regs[17], &e, 0));
+	if (e == curenv) {
+		return -E_INVAL;
+	}
+	return ipc_call(e, &tf->regs[11], 0, 0, 0, 1);
+}
+
+/* Overview:
+ *   Reply to the caller 'envid' (if not 0) with a 'value' (together with the 'npages' contiguous
+ *   pages at 'srcva' if it is not 0), then wait for the next message at 'dstva' like
+ *   'sys_ipc_recv' (taking the notification bits in 'notify'). All pages are mapped with 'perm'
+ *   in one go, and fail with -E_INVAL returned to the caller if they do not fit in its window.
+ *   The reply is dropped unless 'envid' is waiting for the reply to a 'sys_ipc_call' taken by
+ *   'curenv'. If no message is queued, the CPU is handed over to the caller directly instead of
+ *   going through 'schedule'.
+ *
+ * Post-Condition:
+ *   Return 0 once a message is received, which is read from 'env_ipc_*' like 'sys_ipc_recv'.
+ *   Return -E_INVAL if 'srcva' or 'dstva' is illegal, or 'notify' is not within 'NOTIFY_ALL'.
+ */
+int sys_ipc_reply_recv(u_long envid, u_long value, u_long srcva, u_long perm, u_long dstva,
+		       u_long npages, u_long notify) {
+	struct Env *e = NULL;
+	u_long msg[IPC_MSG_WORDS] = {value};
+
+	if (npages == 0) {
+		npages = 1;
+	}
+	if ((srcva != 0 && (npages > UTOP / PAGE_SIZE ||
+			    is_illegal_va_range(srcva, npages * PAGE_SIZE))) ||
+	    (dstva != 0 && is_illegal_va(dstva)) || (notify & ~NOTIFY_ALL)) {
+		return -E_INVAL;
+	}
+
+	if (envid != 0 && envid2env(envid, &e, 0) == 0 && e != curenv && e->env_ipc_recving &&
+	    e->env_ipc_callee == curenv->env_id) {
+		env_wakeup(e, ipc_deliver(curenv, e, msg, srcva, npages, PTE_V | perm));
+	} else {
+		e = NULL;
+	}
+
+	if (ipc_recv_queued(dstva, notify)) {
 		return 0;
 	}
+	env_block(curenv, TIMER_NEVER);
+	curenv->env_stat_ipc = 1;
 
-	memcpy((void *)&write_buffer.data, (void *)pa, SECTOR_SIZE);
+	if (e) {
+		curenv->env_stat.es_voluntary++;
+		env_run(e);
+	}
+	schedule(1);
+}
 
-	u_long diskva = 0xb0008000;
-	struct Virtio *disk = (struct Virtio *)diskva;
-	write_sector(disk, sector);
+/* Overview:
+ *   Copy the scheduling statistics of 'envid' to 'st'. Any env may be inspected.
+ *
+ * Post-Condition:
+ *   Return 0 on success.
+ *   Return -E_INVAL if 'st' is illegal or crosses a page boundary.
+ *   Return the original error when underlying calls fail.
+ */
+int sys_env_stat(u_long envid, struct Env_stat *st) {
+	struct Env *e;
 
-	if (write_buffer.status != 0) {
-		panic("Write sector failed!");
+	if (is_illegal_va_range((u_long)st, sizeof *st) ||
+	    ROUNDDOWN((u_long)st, PAGE_SIZE) != ROUNDDOWN((u_long)st + sizeof *st - 1, PAGE_SIZE)) {
+		return -E_INVAL;
 	}
+	try(envid2env(envid, &e, 0));
+
+	if (!is_mapped_page(&cur_pgdir, (u_long)st)) {
+		try(alloc_page_user(&cur_pgdir, curenv->env_asid, (u_long)st, PTE_R | PTE_W | PTE_U));
+	}
+	env_get_stat(e, (struct Env_stat *)get_pa(&cur_pgdir, (u_long)st));
 	return 0;
 }
 
-int sys_flush() {
-	u_long diskva = 0xb0008000;
-	struct Virtio *disk = (struct Virtio *)diskva;
-	flush(disk);
+/* Overview:
+ *   Execute the 'n' requests in 'vec' in order within a single kernel entry, and store the result
+ *   of each in its 'sr_ret'. Stop at the first request that fails. Requests after it are not
+ *   executed and their 'sr_ret' is left untouched.
+ *
+ * Post-Condition:
+ *   Return the number of requests that succeeded, which is 'n' if none failed. Otherwise
+ *   'vec[r].sr_ret' is the error of the failed one.
+ *   Return -E_INVAL if 'n' is not within [0, SYSREQ_MAX], 'vec' is illegal, or a request has an
+ *   unsupported 'sr_sysno' (nothing is executed in these cases).
+ *
+ * Note:
+ *   'vec' should not be in a page that a request of the batch makes read-only (e.g. by mapping it
+ *   copy-on-write), since results are written back to it.
+ */
+int sys_batch(struct Sysreq *vec, u_long n) {
+	static struct Sysreq reqs[SYSREQ_MAX];
+	u_long i;
 
-	if (flush_buffer.status != 0) {
-		panic("Flush sector failed!");
+	if (n > SYSREQ_MAX || is_illegal_va_range((u_long)vec, n * sizeof *vec)) {
+		return -E_INVAL;
 	}
-	return 0;
+	try(copy_user(reqs, (u_long)vec, n * sizeof *vec, 0));
+	for (i = 0; i < n; i++) {
+		if (reqs[i].sr_sysno != SYS_mem_alloc && reqs[i].sr_sysno != SYS_mem_map &&
+		    reqs[i].sr_sysno != SYS_mem_unmap && reqs[i].sr_sysno != SYS_set_env_status &&
+		    reqs[i].sr_sysno != SYS_futex_wake) {
+			return -E_INVAL;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		struct Sysreq *req = &reqs[i];
+		u_long *a = req->sr_args;
+
+		switch (req->sr_sysno) {
+		case SYS_mem_alloc:
+			req->sr_ret = sys_mem_alloc(a[0], a[1], a[2]);
+			break;
+		case SYS_mem_map:
+			req->sr_ret = sys_mem_map(a[0], a[1], a[2], a[3], a[4]);
+			break;
+		case SYS_mem_unmap:
+			req->sr_ret = sys_mem_unmap(a[0], a[1]);
+			break;
+		case SYS_futex_wake:
+			req->sr_ret = sys_futex_wake(a[0], a[1], a[2]);
+			break;
+		default:
+			req->sr_ret = sys_set_env_status(a[0], a[1]);
+			break;
+		}
+		try(copy_user(&req->sr_ret, (u_long)&vec[i].sr_ret, sizeof req->sr_ret, 1));
+		if (req->sr_ret < 0) {
+			break;
+		}
+	}
+	return i;
 }
 
 void *syscall_table[MAX_SYSNO] = {
@@ -771,7 +1415,40 @@ void *syscall_table[MAX_SYSNO] = {
 	[SYS_read_sector] = sys_read_sector,
 	[SYS_write_sector] = sys_write_sector,
 	[SYS_flush] = sys_flush,
+	[SYS_sleep] = sys_sleep,
+	[SYS_ipc_send] = sys_ipc_send,
+	[SYS_env_stat] = sys_env_stat,
+	[SYS_ipc_call] = sys_ipc_call,
+	[SYS_ipc_reply_recv] = sys_ipc_reply_recv,
+	[SYS_ipc_call_msg] = sys_ipc_call_msg,
+	[SYS_notify] = sys_notify,
+	[SYS_notify_wait] = sys_notify_wait,
+	[SYS_batch] = sys_batch,
+	[SYS_wait] = sys_wait,
+	[SYS_futex_wait] = sys_futex_wait,
+	[SYS_futex_wake] = sys_futex_wake,
+	[SYS_dev_map] = sys_dev_map,
+	[SYS_disk_info] = sys_disk_info,
+};
+
+/*
+ * Syscalls which never block, switch env or touch the trapframe of 'curenv'. 'exc_gen_entry'
+ * calls them directly without saving the full trapframe (see kern/exception_entry.S).
+ */
+void *syscall_fast_table[MAX_SYSNO] = {
+    [SYS_putchar] = sys_putchar,
+    [SYS_print_cons] = sys_print_cons,
+    [SYS_getenvid] = sys_getenvid,
+    [SYS_set_tlb_mod_entry] = sys_set_tlb_mod_entry,
+    [SYS_mem_alloc] = sys_mem_alloc,
+    [SYS_mem_map] = sys_mem_map,
+    [SYS_mem_unmap] = sys_mem_unmap,
+    [SYS_ipc_try_send] = sys_ipc_try_send,
+    [SYS_env_stat] = sys_env_stat,
+    [SYS_notify] = sys_notify,
+    [SYS_futex_wake] = sys_futex_wake,
 };
+u_long syscall_fast_num = MAX_SYSNO;
 
 /* Overview:
  *   Call the function in 'syscall_table' indexed at 'sysno' with arguments from user context and
@@ -784,7 +1461,7 @@ void *syscall_table[MAX_SYSNO] = {
  *   Number of arguments cannot exceed 5.
  */
 void do_syscall(struct Trapframe *tf) {
-	int (*func)(u_long, u_long, u_long, u_long, u_long);
+	int (*func)(u_long, u_long, u_long, u_long, u_long, u_long, u_long);
 	int sysno = tf->regs[10];
 	if (sysno < 0 || sysno >= MAX_SYSNO) {
 		tf->regs[10] = -E_NO_SYS;
@@ -808,6 +1485,8 @@ void do_syscall(struct Trapframe *tf) {
 	u_long arg3 = tf->regs[13];
 	u_long arg4 = tf->regs[14];
 	u_long arg5 = tf->regs[15];
+	u_long arg6 = tf->regs[16];
+	u_long arg7 = tf->regs[17];
 
 	u_long sip;
 	asm volatile("csrr %0, sip" : "=r"(sip));
@@ -824,6 +1503,6 @@ void do_syscall(struct Trapframe *tf) {
 	/* Step 5: Invoke 'func' with retrieved arguments and store its return value to $v0 in 'tf'.
 	 */
 	/* Exercise 4.2: Your code here. (4/4) */
-	tf->regs[10] = func(arg1, arg2, arg3, arg4, arg5);
+	tf->regs[10] = func(arg1, arg2, arg3, arg4, arg5, arg6, arg7);
 
 }
@@ -0,0 +1,153 @@
+#include <asm/csrdef.h>
+#include <printk.h>
+#include <sbi.h>
+#include <timer.h>
+
+// wheel[0] holds timers expiring within TW_SIZE ticks, one slot per tick. Slots of higher levels
+// are cascaded down to the level below whenever the lower level wraps around.
+static struct Timer_list wheel[TW_LEVELS][TW_SIZE];
+static uint64_t tw_jiffies; // the next tick to be processed by 'timer_run'
+static u_int tw_count;	    // number of pending timers
+
+static void timer_insert(struct Timer *t) {
+	uint64_t expire = t->t_expire;
+	uint64_t delta;
+	int level = 0;
+
+	if (expire < tw_jiffies) {
+		expire = tw_jiffies;
+	}
+	delta = expire - tw_jiffies;
+
+	// Timers too far away are parked in the last slot reachable by the top level, and will be
+	// inserted again (by their real 't_expire') when that slot is cascaded.
+	if (delta >= (1ULL << (TW_BITS * TW_LEVELS))) {
+		delta = (1ULL << (TW_BITS * TW_LEVELS)) - 1;
+		expire = tw_jiffies + delta;
+	}
+	while (level < TW_LEVELS - 1 && delta >= (1ULL << (TW_BITS * (level + 1)))) {
+		level++;
+	}
+
+	LIST_INSERT_HEAD(&wheel[level][(expire >> (TW_BITS * level)) & TW_MASK], t, t_link);
+}
+
+/* Overview:
+ *   Move all timers in slot 'index' of 'level' to lower levels.
+ */
+static void timer_cascade(int level, u_int index) {
+	struct Timer *t;
+	struct Timer_list *slot = &wheel[level][index];
+
+	while ((t = LIST_FIRST(slot)) != NULL) {
+		LIST_REMOVE(t, t_link);
+		timer_insert(t);
+	}
+}
+
+/* Overview:
+ *   Let user space read the 'time' CSR with 'rdtime', e.g. for benchmarks.
+ */
+void timer_init(void) {
+	asm volatile("csrs scounteren, %0" : : "r"(2));
+}
+
+void timer_setup(struct Timer *t, void (*func)(void *), void *data) {
+	t->t_pending = 0;
+	t->t_func = func;
+	t->t_data = data;
+}
+
+/* Overview:
+ *   Arm 't' to expire at 'expire' (absolute time in cycles, as read by 'timer_now').
+ *   A pending timer is re-armed.
+ */
+void timer_add(struct Timer *t, uint64_t expire) {
+	timer_cancel(t);
+	if (tw_count == 0) {
+		// Nothing is in the wheel, so there is no need to walk the ticks passed.
+		tw_jiffies = timer_now() / TIMER_TICK;
+	}
+	// Round up, so that a timer never fires early.
+	t->t_expire = (expire + TIMER_TICK - 1) / TIMER_TICK;
+	t->t_pending = 1;
+	tw_count++;
+	timer_insert(t);
+}
+
+void timer_cancel(struct Timer *t) {
+	if (t->t_pending) {
+		LIST_REMOVE(t, t_link);
+		t->t_pending = 0;
+		tw_count--;
+	}
+}
+
+int timer_pending(void) {
+	return tw_count != 0;
+}
+
+/* Overview:
+ *   Advance the wheel to the current time and call the handlers of all expired timers.
+ */
+void timer_run(void) {
+	uint64_t now = timer_now() / TIMER_TICK;
+	struct Timer *t;
+
+	while (tw_count != 0 && tw_jiffies <= now) {
+		u_int index = tw_jiffies & TW_MASK;
+
+		if (index == 0) {
+			for (int level = 1; level < TW_LEVELS; level++) {
+				u_int i = (tw_jiffies >> (TW_BITS * level)) & TW_MASK;
+				timer_cascade(level, i);
+				if (i != 0) {
+					break;
+				}
+			}
+		}
+
+		while ((t = LIST_FIRST(&wheel[0][index])) != NULL) {
+			LIST_REMOVE(t, t_link);
+			t->t_pending = 0;
+			tw_count--;
+			t->t_func(t->t_data);
+		}
+		tw_jiffies++;
+	}
+}
+
+/* Overview:
+ *   Return the time (in cycles) at which 'timer_run' should be called next, or 'TIMER_NEVER' if
+ *   no timer is pending.
+ *
+ * Note:
+ *   Only level 0 is scanned. If it holds nothing before it wraps around, the time of the next
+ *   cascade is returned instead, which may cause a spurious wakeup but never a late one.
+ */
+uint64_t timer_next(void) {
+	uint64_t j = tw_jiffies;
+
+	if (tw_count == 0) {
+		return TIMER_NEVER;
+	}
+	do {
+		if (!LIST_EMPTY(&wheel[0][j & TW_MASK])) {
+			break;
+		}
+		j++;
+	} while (j & TW_MASK);
+	return j * TIMER_TICK;
+}
+
+/* Overview:
+ *   Wait for the next timer or external interrupt with the CPU halted, then run the expired
+ *   timers. Called by 'schedule' when there is no runnable env, which serves the external
+ *   interrupts afterwards.
+ */
+void timer_idle(void) {
+	sbi_set_timer(timer_next());
+	asm volatile("csrs sie, %0" : : "r"(SIE_STIE | SIE_SEIE));
+	asm volatile("wfi");
+	timer_run();
+}
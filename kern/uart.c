@@ -0,0 +1,134 @@
+#include <plic.h>
+#include <uart.h>
+
+#define UART_REG(off) (*(volatile u_char *)(UART_VA + (off)))
+
+// Characters received but not read yet. 'rx_head' and 'rx_tail' only grow.
+static u_char rx_ring[UART_RING_SIZE];
+static u_int rx_head, rx_tail;
+
+// Envs blocked in 'sys_cgetc', in FIFO order.
+static struct Env_wait_list rx_waiters = TAILQ_HEAD_INITIALIZER(rx_waiters);
+
+// Characters to be sent. 'tx_head' and 'tx_tail' only grow.
+static u_char tx_ring[UART_TX_SIZE];
+static u_int tx_head, tx_tail;
+static int tx_intr;  // whether the transmit interrupt is enabled
+static int tx_ready; // whether 'uart_init' is done, before which output goes through the SBI
+
+/* Overview:
+ *   Enable the receive interrupt of the UART, and take over the output from the SBI.
+ */
+void uart_init(void) {
+	// Let the output of the SBI go out before the FIFOs are cleared.
+	while (!(UART_REG(UART_LSR) & UART_LSR_TEMT)) {
+	}
+	UART_REG(UART_FCR) = UART_FCR_FIFO;
+	UART_REG(UART_MCR) |= UART_MCR_OUT2;
+	UART_REG(UART_IER) = UART_IER_RDI;
+	plic_enable(IRQ_UART);
+	tx_ready = 1;
+}
+
+int uart_ready(void) {
+	return tx_ready;
+}
+
+/* Overview:
+ *   Move up to a FIFO of characters from the output ring buffer to the UART if its FIFO is
+ *   empty, and keep the transmit interrupt enabled as long as some are left.
+ */
+static void uart_tx_fill(void) {
+	if (UART_REG(UART_LSR) & UART_LSR_THRE) {
+		for (int i = 0; i < UART_FIFO_SIZE && tx_head != tx_tail; i++) {
+			UART_REG(UART_THR) = tx_ring[tx_head++ % UART_TX_SIZE];
+		}
+	}
+	if ((tx_head != tx_tail) != tx_intr) {
+		tx_intr = tx_head != tx_tail;
+		UART_REG(UART_IER) = UART_IER_RDI | (tx_intr ? UART_IER_THRI : 0);
+	}
+}
+
+static void uart_tx_put(u_char ch) {
+	// Interrupts are disabled in the kernel, so a full ring buffer is drained by polling.
+	while (tx_tail - tx_head == UART_TX_SIZE) {
+		uart_tx_fill();
+	}
+	tx_ring[tx_tail++ % UART_TX_SIZE] = ch;
+	// Start sending if no transmit interrupt is on the way. The rest of a burst is queued.
+	if (!tx_intr) {
+		uart_tx_fill();
+	}
+}
+
+/* Overview:
+ *   Queue 'ch' to be sent, like the SBI console does, with '\n' sent as "\r\n".
+ */
+void uart_putc(char ch) {
+	if (ch == '\n') {
+		uart_tx_put('\r');
+	}
+	uart_tx_put(ch);
+}
+
+/* Overview:
+ *   Send all queued characters by polling, e.g. before the machine is shut down.
+ */
+void uart_flush(void) {
+	while (tx_head != tx_tail) {
+		uart_tx_fill();
+	}
+	while (!(UART_REG(UART_LSR) & UART_LSR_TEMT)) {
+	}
+}
+
+/* Overview:
+ *   Hand the received characters to 'cons_input'.
+ *   Refill the transmit FIFO from the output ring buffer.
+ */
+void uart_intr(void) {
+	if (tx_intr) {
+		uart_tx_fill();
+	}
+
+	while (UART_REG(UART_LSR) & UART_LSR_DR) {
+		cons_input(UART_REG(UART_RBR));
+	}
+}
+
+/* Overview:
+ *   Move the character 'ch' received by a console device to the ring buffer, and hand it to a
+ *   blocked reader if any. Characters are dropped when the ring buffer is full.
+ */
+void cons_input(u_char ch) {
+	struct Env *e;
+
+	if (rx_tail - rx_head < UART_RING_SIZE) {
+		rx_ring[rx_tail++ % UART_RING_SIZE] = ch;
+	}
+	while (rx_head != rx_tail && (e = env_wait_dequeue(&rx_waiters)) != NULL) {
+		env_wakeup(e, rx_ring[rx_head++ % UART_RING_SIZE]);
+	}
+}
+
+/* Overview:
+ *   Return the next character received, or -1 if there is none.
+ */
+int uart_getc(void) {
+	if (rx_head == rx_tail) {
+		return -1;
+	}
+	return rx_ring[rx_head++ % UART_RING_SIZE];
+}
+
+/* Overview:
+ *   Queue the blocked env 'e' to receive the next character as the return value of its syscall.
+ */
+void uart_wait(struct Env *e) {
+	env_wait(e, &rx_waiters);
+}
+
+int uart_waiting(void) {
+	return !TAILQ_EMPTY(&rx_waiters);
+}
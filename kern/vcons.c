@@ -0,0 +1,205 @@
+#include <drivers/console.h>
+#include <env.h>
+#include <error.h>
+#include <printk.h>
+#include <uart.h>
+#include <vcons.h>
+#include <virtio.h>
+
+#ifdef RISCV32
+typedef le32 le;
+#else
+typedef le64 le;
+#endif
+
+/*
+ * A virtio-console device as the console, taking over the output from the UART once it is up
+ * (see 'printcharc'). Output is queued in a ring buffer, and each contiguous run of it is sent
+ * as one buffer, so that a burst of output costs one notification of the device. Input is
+ * received in buffers posted in advance, and goes to the readers of the UART.
+ */
+
+static struct Virtio *vcons;
+static struct virtq rxq, txq;
+static u_char vcons_rings[2][PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static u_short rx_last_used, tx_last_used;
+
+static u_char rx_bufs[VCONS_RX_NBUF][VCONS_RX_BUF];
+
+// Characters to be sent. Those from 'tx_head' to 'tx_sent' are being sent by the device, those
+// from 'tx_sent' to 'tx_tail' are not submitted yet. All three only grow.
+static u_char tx_ring[VCONS_TX_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static u_int tx_head, tx_sent, tx_tail;
+// Transmit buffers are submitted with descriptor 'seq % txq.num' for the 'seq'th of them. Those
+// from 'tx_done' to 'tx_seq' are not completed in order yet, with their length and whether the
+// device has used them already.
+static u_int tx_seq, tx_done;
+static u_int tx_len[VIRTQ_PAGE_NUM];
+static u_char tx_used[VIRTQ_PAGE_NUM];
+
+static void vcons_intr(u_int slot);
+
+static void rx_post(u_short d) {
+	rxq.desc[d].addr = (le)rx_bufs[d];
+	rxq.desc[d].len = VCONS_RX_BUF;
+	rxq.desc[d].flags = VIRTQ_DESC_F_WRITE;
+	rxq.avail->ring[rxq.avail->idx % rxq.num] = d;
+	__sync_synchronize();
+	rxq.avail->idx++;
+}
+
+/* Overview:
+ *   Set up the virtio-console device in virtio-mmio 'slot' as the console.
+ *
+ * Post-Condition:
+ *   Return 0 on success, or -E_IO if the device is unusable, with FAILED set.
+ */
+int vcons_init(u_int slot) {
+	struct Virtio *dev = (struct Virtio *)VIRTIO_VA(slot);
+	uint64_t features;
+
+	dev->status = 0;
+	dev->status |= ACKNOWLEDGE | DRIVER;
+	if (virtio_negotiate(dev, 1ULL << VIRTIO_F_VERSION_1, &features) != 0 ||
+	    virtq_setup(dev, VCONS_RXQ, &rxq, vcons_rings[0]) != 0 ||
+	    virtq_setup(dev, VCONS_TXQ, &txq, vcons_rings[1]) != 0) {
+		dev->status |= FAILED;
+		return -E_IO;
+	}
+	dev->status |= DRIVER_OK;
+
+	for (u_short d = 0; d < MIN(rxq.num, VCONS_RX_NBUF); d++) {
+		rx_post(d);
+	}
+	dev->queue_notify = VCONS_RXQ;
+
+	// Let the output of the UART go out first.
+	printflush();
+	vcons = dev;
+	virtio_set_intr(slot, vcons_intr);
+	return 0;
+}
+
+int vcons_ready(void) {
+	return vcons != NULL;
+}
+
+/* Overview:
+ *   Release the output sent by the device, in order of submission.
+ */
+static void tx_reap(void) {
+	while (tx_last_used != txq.used->idx) {
+		// Read the entry only after its index.
+		__sync_synchronize();
+		tx_used[txq.used->ring[tx_last_used % txq.num].id] = 1;
+		tx_last_used++;
+	}
+	while (tx_done != tx_seq && tx_used[tx_done % txq.num]) {
+		tx_used[tx_done % txq.num] = 0;
+		tx_head += tx_len[tx_done % txq.num];
+		tx_done++;
+	}
+}
+
+/* Overview:
+ *   Submit the output queued but not submitted yet, as one buffer per contiguous run of the ring
+ *   buffer, and notify the device.
+ */
+static void tx_start(void) {
+	int started = 0;
+
+	while (tx_sent != tx_tail && tx_seq - tx_done < txq.num) {
+		u_int off = tx_sent % VCONS_TX_SIZE;
+		u_int len = MIN(tx_tail - tx_sent, VCONS_TX_SIZE - off);
+		u_short d = tx_seq % txq.num;
+
+		txq.desc[d].addr = (le)&tx_ring[off];
+		txq.desc[d].len = len;
+		txq.desc[d].flags = 0;
+		tx_len[d] = len;
+		txq.avail->ring[txq.avail->idx % txq.num] = d;
+		// The device must see the buffer before the new index.
+		__sync_synchronize();
+		txq.avail->idx++;
+		tx_seq++;
+		tx_sent += len;
+		started = 1;
+	}
+	if (started) {
+		__sync_synchronize();
+		vcons->queue_notify = VCONS_TXQ;
+	}
+}
+
+static void tx_put(u_char ch) {
+	// Interrupts are disabled in the kernel, so a full ring buffer is drained by polling.
+	while (tx_tail - tx_head == VCONS_TX_SIZE) {
+		tx_start();
+		tx_reap();
+	}
+	tx_ring[tx_tail++ % VCONS_TX_SIZE] = ch;
+}
+
+/* Overview:
+ *   Queue 'ch' to be sent, like the UART does, with '\n' sent as "\r\n", and start sending it.
+ */
+void vcons_putc(char ch) {
+	if (ch == '\n') {
+		tx_put('\r');
+	}
+	tx_put(ch);
+	tx_start();
+}
+
+/* Overview:
+ *   Queue the 'len' characters at 'buf' to be sent as 'vcons_putc' does, and start sending them
+ *   at once, so that they are sent as one buffer if they fit in the ring buffer.
+ */
+void vcons_write(const char *buf, u_long len) {
+	for (u_long i = 0; i < len; i++) {
+		if (buf[i] == '\n') {
+			tx_put('\r');
+		}
+		tx_put(buf[i]);
+	}
+	tx_start();
+}
+
+/* Overview:
+ *   Wait until all queued output is sent, e.g. before the machine is shut down.
+ */
+void vcons_flush(void) {
+	while (tx_head != tx_tail) {
+		tx_start();
+		tx_reap();
+	}
+}
+
+/* Overview:
+ *   Hand the characters received to the readers of the console, post the buffers again, and
+ *   submit the output waiting for the buffers the device has sent.
+ */
+static void vcons_intr(u_int slot) {
+	int received = 0;
+
+	vcons->interrupt_ack = vcons->interrupt_status;
+
+	while (rx_last_used != rxq.used->idx) {
+		__sync_synchronize();
+		struct virtq_used_elem *u = &rxq.used->ring[rx_last_used % rxq.num];
+		u_short d = u->id;
+		for (u_int i = 0; i < u->len && i < VCONS_RX_BUF; i++) {
+			cons_input(rx_bufs[d][i]);
+		}
+		rx_last_used++;
+		rx_post(d);
+		received = 1;
+	}
+	if (received) {
+		__sync_synchronize();
+		vcons->queue_notify = VCONS_RXQ;
+	}
+
+	tx_reap();
+	tx_start();
+}
@@ -1,19 +1,17 @@
 #include <virtio.h>
 #include <asm/asm.h>
+#include <balloon.h>
 #include <env.h>
+#include <error.h>
 #include <kclock.h>
+#include <plic.h>
 #include <pmap.h>
 #include <printk.h>
 #include <trap.h>
+#include <vcons.h>
 #include <sbi.h>
 
-struct virtq vq __attribute__((aligned(PAGE_SIZE)));
-struct virtq_desc desc[QUEUE_SIZE] __attribute__((aligned(PAGE_SIZE)));
-struct virtq_avail avail[1] __attribute__((aligned(PAGE_SIZE)));
-struct virtq_used used[1] __attribute__((aligned(PAGE_SIZE)));
-struct virtio_blk_req read_buffer;
-struct virtio_blk_req write_buffer;
-struct virtio_blk_req flush_buffer;
+extern struct Env envs[];
 
 #ifdef RISCV32
 typedef le32 le;
@@ -21,6 +19,52 @@ typedef le32 le;
 typedef le64 le;
 #endif
 
+// Features of the disk we use if offered.
+#define VBLK_FEATURES                                                                              \
+	((1ULL << VIRTIO_F_VERSION_1) | (1ULL << VIRTIO_F_INDIRECT_DESC) |                         \
+	 (1ULL << VIRTIO_F_EVENT_IDX) | (1ULL << VIRTIO_BLK_F_SEG_MAX) |                            \
+	 (1ULL << VIRTIO_BLK_F_BLK_SIZE) | (1ULL << VIRTIO_BLK_F_FLUSH))
+
+/*
+ * A virtio-blk device driven by the kernel, with its own queue. Disks are numbered in the order
+ * QEMU puts them, from the last virtio-mmio slot down, i.e. the order of their '-device'.
+ */
+struct Vblk {
+	struct Virtio *v_dev; // NULL if not driven by the kernel (see 'virtio_grant')
+	u_int v_slot;
+	uint64_t v_features; // negotiated
+	uint64_t v_capacity; // in sectors
+	struct virtq v_vq;
+
+	// Free descriptors are chained by their 'next' field.
+	u_short v_desc_free;
+	u_int v_desc_nfree;
+	// The request of each submitted descriptor chain, indexed by its head.
+	struct Vblk_req *v_desc_req[VIRTQ_PAGE_NUM];
+	// The next entry of the used ring to be processed.
+	u_short v_last_used;
+	// The available index when the device was last notified.
+	u_short v_avail_notified;
+	// Requests submitted when there were not enough free descriptors, in FIFO order.
+	TAILQ_HEAD(, Vblk_req) v_pending;
+};
+
+static u_char vblk_rings[VIRTIO_NDEV][PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static struct Vblk vblks[VIRTIO_NDEV];
+static u_int nvblk;
+
+// The env driving each device itself (see 'virtio_grant'), or 0, and the notification bits the
+// interrupts of the device are posted to it as.
+static u_int dev_owner[VIRTIO_NDEV];
+static u_int dev_bits[VIRTIO_NDEV];
+// The interrupt handler of each device driven by the kernel (see 'virtio_set_intr').
+static void (*dev_intr[VIRTIO_NDEV])(u_int slot);
+
+static struct Vblk_req vblk_reqs[NENV];
+
+static int vblk_init(struct Vblk *v, u_int slot);
+static void vblk_intr(u_int slot);
+
 void virtio_init() {
 	for (u_long diskva = 0xb0001000; diskva < 0xb0009000; diskva += 0x1000) {
 		struct Virtio *disk = (struct Virtio *)diskva;
@@ -45,17 +89,65 @@ void virtio_init() {
 		printk("\n");
 	}
 
-	u_long diskva = 0xb0008000; // 映射到了这个虚拟地址
-	struct Virtio *disk = (struct Virtio *)diskva;
-	printk("queue num max    : %08x\n", disk->queue_num_max);
+	for (int slot = VIRTIO_NDEV - 1; slot >= 0; slot--) {
+		u_int device_id = ((struct Virtio *)VIRTIO_VA(slot))->device_id;
+		if (device_id == 2 && vblk_init(&vblks[nvblk], slot) == 0) {
+			printk("virtio: disk %d in slot %d\n", nvblk, slot);
+			nvblk++;
+		} else if (device_id == 3 && !vcons_ready() && vcons_init(slot) == 0) {
+			printk("virtio: console in slot %d\n", slot);
+		} else if (device_id == 5 && balloon_init(slot) == 0) {
+			printk("virtio: balloon in slot %d\n", slot);
+		}
+	}
+}
+
+/* Overview:
+ *   Set up virtqueue 'sel' of 'dev', whose status has FEATURES_OK set, on the page 'page' as
+ *   'vq', with as many entries as fit (see 'VIRTQ_PAGE_NUM') and the device supports.
+ *
+ * Post-Condition:
+ *   Return 0 on success, or -E_IO if the device has no such queue.
+ */
+int virtq_setup(struct Virtio *dev, u_int sel, struct virtq *vq, void *page) {
+	dev->queue_sel = sel;
+	if (dev->queue_num_max == 0 || dev->queue_ready != 0) {
+		return -E_IO;
+	}
+
+	// The page may hold the rings of a previous setup of the device, which start over.
+	memset(page, 0, PAGE_SIZE);
+	vq->num = MIN(dev->queue_num_max, VIRTQ_PAGE_NUM);
+	vq->desc = (struct virtq_desc *)page;
+	vq->avail = (struct virtq_avail *)((u_char *)page + VIRTQ_AVAIL_OFF);
+	vq->used = (struct virtq_used *)((u_char *)page + VIRTQ_USED_OFF);
+	dev->queue_num = vq->num;
 
-	u_int magic_value = disk->magic_value;
-	u_int version = disk->version;
-	u_int device_id = disk->device_id;
-	printk("magic value      : %08x\n", magic_value);
-	printk("version          : %08x\n", version);
-	printk("device id        : %08x\n", device_id);
-	assert(device_id == 2);
+	dev->queue_desc = (le)vq->desc;
+	dev->queue_avail = (le)vq->avail;
+	dev->queue_used = (le)vq->used;
+
+	dev->queue_ready = 1;
+	return 0;
+}
+
+/* Overview:
+ *   Call 'handler' on the interrupts of the device in virtio-mmio 'slot', which the kernel
+ *   drives, and enable them.
+ */
+void virtio_set_intr(u_int slot, void (*handler)(u_int slot)) {
+	dev_intr[slot] = handler;
+	plic_enable(IRQ_VIRTIO0 + slot);
+}
+
+/* Overview:
+ *   Set up the disk in virtio-mmio 'slot' as 'v'.
+ *
+ * Post-Condition:
+ *   Return 0 on success, or -E_IO if the disk is unusable, with FAILED set.
+ */
+static int vblk_init(struct Vblk *v, u_int slot) {
+	struct Virtio *disk = (struct Virtio *)VIRTIO_VA(slot);
 
 	// The driver MUST follow this sequence to initialize a device:
 
@@ -70,24 +162,54 @@ void virtio_init() {
 	 * Read device feature bits, and write the subset of feature bits understood by the OS and driver to the
 	 * device. During this step the driver MAY read (but MUST NOT write) the device-specific configuration
 	 * fields to check that it can support the device before accepting it.
-	*/
-	u_int device_features = disk->device_features;
-	printk("feature bits     : %016lx\n", device_features);
-	disk->driver_features = device_features;
-
-	// Set the FEATURES_OK status bit. The driver MUST NOT accept new feature bits after this step.
-	disk->status |= FEATURES_OK;
-
-	/**
+	 *
+	 * Set the FEATURES_OK status bit. The driver MUST NOT accept new feature bits after this step.
+	 *
 	 * Re-read device status to ensure the FEATURES_OK bit is still set: otherwise, the device does not
 	 * support our subset of features and the device is unusable.
 	*/
-	printk("status           : %016lx\n", disk->status);
+	if (virtio_negotiate(disk, VBLK_FEATURES, &v->v_features) != 0) {
+		disk->status |= FAILED;
+		printk("virtio %d: the disk rejects features %016lx\n", slot, (u_long)v->v_features);
+		return -E_IO;
+	}
 
 	/**
 	 * Perform device-specific setup, including discovery of virtqueues for the device, optional per-bus setup,
 	 * reading and possibly writing the device’s virtio configuration space, and population of virtqueues.
 	*/
+	v->v_capacity = virtio_blk_capacity(disk);
+	if ((v->v_features & (1ULL << VIRTIO_BLK_F_SEG_MAX)) && disk->config.seg_max < VBLK_MAX_SEGS) {
+		printk("virtio %d: the disk takes %d segments per request, %d needed\n", slot,
+		       disk->config.seg_max, VBLK_MAX_SEGS);
+		disk->status |= FAILED;
+		return -E_IO;
+	}
+	printk("virtio %d: features %016lx, %lx sectors", slot, (u_long)v->v_features,
+	       (u_long)v->v_capacity); // 6.17 printk 尚未支持 long long，因此不加 (u_long) 可能导致异常
+	if (v->v_features & (1ULL << VIRTIO_BLK_F_BLK_SIZE)) {
+		printk(", block size %d", disk->config.blk_size);
+	}
+	printk("\n");
+
+	/**
+	 * When the driver wants to send a request to the device, it fills in a slot in the descriptor table (or chains several
+	 * together), and writes the descriptor index into the available ring. It then notifies the device. When the device
+	 * has finished a request, it writes the descriptor index into the used ring, and sends an interrupt.
+	*/
+	if (virtq_setup(disk, 0, &v->v_vq, vblk_rings[slot]) != 0) {
+		disk->status |= FAILED;
+		return -E_IO;
+	}
+
+	for (int i = 0; i < v->v_vq.num; i++) {
+		v->v_vq.desc[i].next = i + 1;
+	}
+	v->v_desc_free = 0;
+	v->v_desc_nfree = v->v_vq.num;
+	v->v_last_used = 0;
+	v->v_avail_notified = 0;
+	TAILQ_INIT(&v->v_pending);
 
 	// Set the DRIVER_OK status bit. At this point the device is “live”.
 	disk->status |= DRIVER_OK;
@@ -100,168 +222,374 @@ void virtio_init() {
 	 * The driver MUST NOT notify the device before setting DRIVER_OK.
 	*/
 
+	v->v_dev = disk;
+	v->v_slot = slot;
+	virtio_set_intr(slot, vblk_intr);
+	return 0;
+}
 
-	/**
-	 * When the driver wants to send a read_buffer to the device, it fills in a slot in the descriptor table (or chains several
-	 * together), and writes the descriptor index into the available ring. It then notifies the device. When the device
-	 * has finished a read_buffer, it writes the descriptor index into the used ring, and sends an interrupt.
-	*/
-
-	disk->queue_num = QUEUE_SIZE;
-
-	disk->queue_desc = (le)desc;
-	disk->queue_avail = (le)avail;
-	disk->queue_used = (le)used;
-
-	assert(disk->queue_ready == 0);
-	disk->queue_ready = 1;
-	assert(disk->queue_ready == 1);
-	
-	read_buffer.type = VIRTIO_BLK_T_IN; // 读
-
-	desc[0].addr = (le)&read_buffer;
-	desc[0].len = 16;
-	desc[0].flags = VIRTQ_DESC_F_NEXT;
-	desc[0].next = 1;
-
-	desc[1].addr = (le)&read_buffer.data;
-	desc[1].len = 512;
-	desc[1].flags = VIRTQ_DESC_F_WRITE | VIRTQ_DESC_F_NEXT; // 设备可写
-	desc[1].next = 2;
-
-	desc[2].addr = (le)&read_buffer.status;
-	desc[2].len = 1;
-	desc[2].flags = VIRTQ_DESC_F_WRITE;
-
-    write_buffer.type = VIRTIO_BLK_T_OUT; // 写
-
-    desc[3].addr = (le)&write_buffer;
-	desc[3].len = 16;
-	desc[3].flags = VIRTQ_DESC_F_NEXT;
-	desc[3].next = 4;
-
-	desc[4].addr = (le)&write_buffer.data;
-	desc[4].len = 512;
-	desc[4].flags = VIRTQ_DESC_F_NEXT; // 设备可读
-	desc[4].next = 5;
-
-	desc[5].addr = (le)&write_buffer.status;
-	desc[5].len = 1;
-	desc[5].flags = VIRTQ_DESC_F_WRITE;
-
-	flush_buffer.type = VIRTIO_BLK_T_FLUSH; // flush
-
-    desc[6].addr = (le)&flush_buffer;
-	desc[6].len = 16;
-	desc[6].flags = VIRTQ_DESC_F_NEXT;
-	desc[6].next = 7;
-
-	desc[7].addr = (le)&flush_buffer.data;
-	desc[7].len = 512;
-	desc[7].flags = VIRTQ_DESC_F_NEXT; // 设备可读
-	desc[7].next = 8;
-
-	desc[8].addr = (le)&flush_buffer.status;
-	desc[8].len = 1;
-	desc[8].flags = VIRTQ_DESC_F_WRITE;
-
-	// for (int i = 0; i < 3; i++) {
-	// 	printk("%lx-%lx\n", desc[i].addr, desc[i].addr + desc[i].len);
-	// }
-	printk("device size      : %lx\n", (u_long)disk->config.capacity); // 6.17 printk 尚未支持 long long，因此不加 (u_long) 可能导致异常
-	printk("config generation: %d\n", disk->config_generation);
-	// printk("size=%d\n", (le)sizeof(read_buffer));
-
-
-
-	// 测试读写功能
-
-    // read_sector(disk, 8);
-    // memcpy((void *)&write_buffer.data, (void *)&read_buffer.data, 512);
-    // ((u_long *)write_buffer.data)[0] = 0x12345678;
-    // write_sector(disk, 8);
-    // read_sector(disk, 8);
-
-	// printk("sector = %d\n", read_buffer.sector);
-    // debug_sector(write_buffer);
-    // debug_sector(read_buffer);
+static u_short desc_alloc(struct Vblk *v) {
+	u_short i = v->v_desc_free;
+	v->v_desc_free = v->v_vq.desc[i].next;
+	v->v_desc_nfree--;
+	return i;
+}
 
-	// halt();
+static void desc_free_chain(struct Vblk *v, u_short head) {
+	u_short i = head;
+	int more;
+
+	do {
+		u_short next = v->v_vq.desc[i].next;
+		more = v->v_vq.desc[i].flags & VIRTQ_DESC_F_NEXT;
+		v->v_vq.desc[i].next = v->v_desc_free;
+		v->v_desc_free = i;
+		v->v_desc_nfree++;
+		i = next;
+	} while (more);
+}
 
+/* Overview:
+ *   Return the disk in virtio-mmio 'slot', or NULL if there is none.
+ */
+static struct Vblk *vblk_of_slot(u_int slot) {
+	for (u_int i = 0; i < nvblk; i++) {
+		if (vblks[i].v_slot == slot) {
+			return &vblks[i];
+		}
+	}
+	return NULL;
+}
 
+/* Overview:
+ *   Return the block request of env 'e'.
+ *   The request of a freed env in the same slot may still be in flight, and is waited for here.
+ */
+struct Vblk_req *vblk_req_get(struct Env *e) {
+	struct Vblk_req *r = &vblk_reqs[ENVX(e->env_id)];
 
-	// disk->queue_sel = 0;
-	// printk("0 %016lx\n", disk->queue_num_max);
-	// disk->queue_sel = 1;
-	// printk("1 %016lx\n", disk->queue_num_max);
-	// disk->queue_sel = 2;
-	// printk("2 %016lx\n", disk->queue_num_max);
-	
-	// halt();
+	while (r->r_busy) {
+		virtio_intr(vblks[r->r_disk].v_slot);
+	}
+	r->r_env = e;
+	return r;
 }
 
-void read_sector(struct Virtio *disk, le64 sector) {
-    read_buffer.sector = sector;
-	read_buffer.status = -1;
+/* Overview:
+ *   Make the descriptor chain of 'r' available to disk 'v', without notifying it.
+ *   With VIRTIO_F_INDIRECT_DESC the chain in 'r->r_table' takes a single ring descriptor,
+ *   otherwise it is copied to the descriptor table.
+ *
+ * Post-Condition:
+ *   Return 0 on success, or -E_NO_MEM if there are not enough free descriptors.
+ */
+static int vblk_start(struct Vblk *v, struct Vblk_req *r) {
+	struct virtq_desc *desc = v->v_vq.desc;
+	struct virtq_avail *avail = v->v_vq.avail;
+	u_int n = r->r_nseg + 2;
+	u_short head, d;
+
+	if (v->v_features & (1ULL << VIRTIO_F_INDIRECT_DESC)) {
+		if (v->v_desc_nfree < 1) {
+			return -E_NO_MEM;
+		}
+		head = desc_alloc(v);
+		desc[head].addr = (le)r->r_table;
+		desc[head].len = n * sizeof(struct virtq_desc);
+		desc[head].flags = VIRTQ_DESC_F_INDIRECT;
+	} else {
+		if (v->v_desc_nfree < n) {
+			return -E_NO_MEM;
+		}
+		head = d = desc_alloc(v);
+		for (u_int i = 0; i < n; i++) {
+			desc[d].addr = r->r_table[i].addr;
+			desc[d].len = r->r_table[i].len;
+			desc[d].flags = r->r_table[i].flags;
+			if (i + 1 < n) {
+				desc[d].next = desc_alloc(v);
+				d = desc[d].next;
+			}
+		}
+	}
 
-    avail->ring[avail->idx & (QUEUE_SIZE - 1)] = 0;
+	v->v_desc_req[head] = r;
+	avail->ring[avail->idx % v->v_vq.num] = head;
+	// The device must see the chain before the new index.
+	__sync_synchronize();
 	avail->idx++;
+	return 0;
+}
+
+/* Overview:
+ *   Notify disk 'v' of the chains made available since the last time, unless it asked not to
+ *   be: with VIRTIO_F_EVENT_IDX, until the available index passes its 'avail_event'.
+ */
+static void vblk_kick(struct Vblk *v) {
+	u_short old = v->v_avail_notified;
+	u_short new = v->v_vq.avail->idx;
+	int need;
+
+	// The device must see the new index before we read whether it wants to be notified.
+	__sync_synchronize();
+	v->v_avail_notified = new;
+	if (v->v_features & (1ULL << VIRTIO_F_EVENT_IDX)) {
+		need = virtq_need_event(*virtq_avail_event(&v->v_vq), new, old);
+	} else {
+		need = !(v->v_vq.used->flags & VIRTQ_USED_F_NO_NOTIFY);
+	}
+	if (need) {
+		v->v_dev->queue_notify = 0;
+	}
+}
 
-    disk->queue_notify = 0;
+/* Overview:
+ *   Submit the block request 'r' to disk 'r->r_disk'. The pages of its data are pinned until it
+ *   completes, when 'r->r_env' is woken up with 0, or -E_IO if the device failed it.
+ *   The caller should block 'r->r_env' before calling 'schedule'.
+ *
+ * Post-Condition:
+ *   Return 1 if 'r' is submitted.
+ *   Return 0 if there is nothing to do, i.e. a flush of a disk without a write cache.
+ *   Return -E_INVAL if there is no such disk driven by the kernel, or the sectors are beyond its
+ *   end.
+ */
+int vblk_submit(struct Vblk_req *r) {
+	struct Vblk *v;
+	u_short data_flags = r->r_hdr.type == VIRTIO_BLK_T_IN ? VIRTQ_DESC_F_WRITE : 0;
+	u_long nsecs = 0;
+
+	if (r->r_disk >= nvblk || (v = &vblks[r->r_disk])->v_dev == NULL) {
+		return -E_INVAL;
+	}
+	if (r->r_hdr.type == VIRTIO_BLK_T_FLUSH && !(v->v_features & (1ULL << VIRTIO_BLK_F_FLUSH))) {
+		return 0;
+	}
+	for (u_int i = 0; i < r->r_nseg; i++) {
+		nsecs += r->r_seg[i].len / SECTOR_SIZE;
+	}
+	if (r->r_hdr.sector > v->v_capacity || nsecs > v->v_capacity - r->r_hdr.sector) {
+		return -E_INVAL;
+	}
 
-    while (used->idx < avail->idx) {
-		// printk("-");
+	r->r_table[0].addr = (le)&r->r_hdr;
+	r->r_table[0].len = sizeof(r->r_hdr);
+	r->r_table[0].flags = VIRTQ_DESC_F_NEXT;
+	r->r_table[0].next = 1;
+	for (u_int i = 0; i < r->r_nseg; i++) {
+		struct Vblk_seg *s = &r->r_seg[i];
+		for (u_long pa = ROUNDDOWN(s->pa, PAGE_SIZE); pa < s->pa + s->len; pa += PAGE_SIZE) {
+			pa2page(pa)->pp_ref++;
+		}
+		r->r_table[i + 1].addr = s->pa;
+		r->r_table[i + 1].len = s->len;
+		r->r_table[i + 1].flags = VIRTQ_DESC_F_NEXT | data_flags;
+		r->r_table[i + 1].next = i + 2;
 	}
+	r->r_table[r->r_nseg + 1].addr = (le)&r->r_status;
+	r->r_table[r->r_nseg + 1].len = 1;
+	r->r_table[r->r_nseg + 1].flags = VIRTQ_DESC_F_WRITE; // 设备可写
+	r->r_table[r->r_nseg + 1].next = 0;
 
-	// printk("%x\n", sector);
-	// debug_sector(read_buffer);
+	r->r_status = -1;
+	r->r_busy = 1;
 
-	// printk("read %d %x\n", used->idx, read_buffer.status);
+	if (!TAILQ_EMPTY(&v->v_pending) || vblk_start(v, r) != 0) {
+		TAILQ_INSERT_TAIL(&v->v_pending, r, r_link);
+		return 1;
+	}
+	vblk_kick(v);
+	return 1;
 }
 
-void write_sector(struct Virtio *disk, le64 sector) {
-    write_buffer.sector = sector;
-	write_buffer.status = -1;
-
-    avail->ring[avail->idx & (QUEUE_SIZE - 1)] = 3;
-	avail->idx++;
+static void vblk_complete(struct Vblk_req *r) {
+	for (u_int i = 0; i < r->r_nseg; i++) {
+		struct Vblk_seg *s = &r->r_seg[i];
+		for (u_long pa = ROUNDDOWN(s->pa, PAGE_SIZE); pa < s->pa + s->len; pa += PAGE_SIZE) {
+			page_decref(pa2page(pa));
+		}
+	}
+	r->r_busy = 0;
+	if (r->r_env) {
+		env_wakeup(r->r_env, r->r_status == VIRTIO_BLK_S_OK ? 0 : -E_IO);
+		r->r_env = NULL;
+	}
+}
 
-    disk->queue_notify = 0;
+/* Overview:
+ *   Serve an interrupt of the device in virtio-mmio 'slot'. The interrupts of a device granted
+ *   to an env are acknowledged and posted to it.
+ */
+void virtio_intr(u_int slot) {
+	struct Env *e;
 
-    while (used->idx < avail->idx) {
-		// printk("-");
+	if (slot >= VIRTIO_NDEV) {
+		return;
 	}
+	if (dev_owner[slot] != 0) {
+		struct Virtio *dev = (struct Virtio *)VIRTIO_VA(slot);
+		dev->interrupt_ack = dev->interrupt_status;
+		if (envid2env(dev_owner[slot], &e, 0) == 0) {
+			env_notify(e, dev_bits[slot]);
+		}
+		return;
+	}
+	if (dev_intr[slot] != NULL) {
+		dev_intr[slot](slot);
+	}
+}
 
-	// printk("%x\n", sector);
-	// debug_sector(write_buffer);
+/* Overview:
+ *   Complete the requests used by the disk in virtio-mmio slot 'slot', and submit the pending
+ *   ones that fit in the descriptors freed. Called on its interrupt.
+ */
+static void vblk_intr(u_int slot) {
+	struct Vblk *v;
+	struct Vblk_req *r;
+	int started = 0;
+
+	if ((v = vblk_of_slot(slot)) == NULL || v->v_dev == NULL) {
+		return;
+	}
+	v->v_dev->interrupt_ack = v->v_dev->interrupt_status;
+
+	do {
+		while (v->v_last_used != v->v_vq.used->idx) {
+			// Read the entry only after its index.
+			__sync_synchronize();
+			u_short head = v->v_vq.used->ring[v->v_last_used % v->v_vq.num].id;
+			v->v_last_used++;
+			r = v->v_desc_req[head];
+			v->v_desc_req[head] = NULL;
+			desc_free_chain(v, head);
+			vblk_complete(r);
+		}
+		// With VIRTIO_F_EVENT_IDX, ask for an interrupt on the next used entry only. One used
+		// before the device sees this raises none, so check again.
+		*virtq_used_event(&v->v_vq) = v->v_last_used;
+		__sync_synchronize();
+	} while (v->v_last_used != v->v_vq.used->idx);
+
+	while ((r = TAILQ_FIRST(&v->v_pending)) != NULL && vblk_start(v, r) == 0) {
+		TAILQ_REMOVE(&v->v_pending, r, r_link);
+		started = 1;
+	}
+	if (started) {
+		vblk_kick(v);
+	}
+}
 
-	// printk("write %d %x\n", used->idx, write_buffer.status);
+/* Overview:
+ *   Return whether any block request is in flight on disk 'v'. Its completion wakes an env up.
+ */
+static int vblk_busy(struct Vblk *v) {
+	return v->v_dev && (v->v_desc_nfree != v->v_vq.num || !TAILQ_EMPTY(&v->v_pending));
 }
 
-void flush(struct Virtio *disk) {
-    flush_buffer.sector = 0;
-	flush_buffer.status = -1;
+/* Overview:
+ *   Return whether an interrupt of some device may still wake an env up: a block request is in
+ *   flight, or a device is granted to an env.
+ */
+int virtio_busy(void) {
+	for (u_int i = 0; i < nvblk; i++) {
+		if (vblk_busy(&vblks[i])) {
+			return 1;
+		}
+	}
+	for (u_int i = 0; i < VIRTIO_NDEV; i++) {
+		if (dev_owner[i] != 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
 
-    avail->ring[avail->idx & (QUEUE_SIZE - 1)] = 6;
-	avail->idx++;
+/* Overview:
+ *   Fill 'info' with what user space needs to know about disk 'disk'.
+ *
+ * Post-Condition:
+ *   Return 0 on success, or -E_INVAL if there is no such disk.
+ */
+int vblk_info(u_int disk, struct Disk_info *info) {
+	if (disk >= nvblk) {
+		return -E_INVAL;
+	}
+	info->di_slot = vblks[disk].v_slot;
+	info->di_capacity = vblks[disk].v_capacity;
+	return 0;
+}
 
-    disk->queue_notify = 0;
+/* Overview:
+ *   Return whether devices may be granted to 'e'. A device may write any memory through DMA, so
+ *   only the file system server created by the kernel is trusted with them.
+ */
+static int virtio_trusted(struct Env *e) {
+	return e == &envs[FS_SERV_ENVX] && e->env_parent_id == 0;
+}
 
-    while (used->idx < avail->idx) {
-		// printk("-");
+/* Overview:
+ *   Let 'e' drive the device in virtio-mmio 'slot' itself, and post its interrupts to 'e' as the
+ *   notification 'bits' (see 'sys_notify'). If it is a disk driven by the kernel, the requests
+ *   in flight are completed first, and the kernel stops using it until 'e' is freed.
+ *
+ * Post-Condition:
+ *   Return 0 on success.
+ *   Return -E_PERM if 'e' is not trusted with devices (see 'virtio_trusted').
+ *   Return -E_INVAL if there is no device in 'slot', or it is granted to an env already.
+ */
+int virtio_grant(struct Env *e, u_int slot, u_int bits) {
+	struct Vblk *v;
+
+	if (!virtio_trusted(e)) {
+		return -E_PERM;
+	}
+	if (slot >= VIRTIO_NDEV || dev_owner[slot] != 0 ||
+	    ((struct Virtio *)VIRTIO_VA(slot))->device_id == 0 ||
+	    (dev_intr[slot] != NULL && dev_intr[slot] != vblk_intr)) {
+		return -E_INVAL;
 	}
+	if ((v = vblk_of_slot(slot)) != NULL && v->v_dev != NULL) {
+		while (vblk_busy(v)) {
+			virtio_intr(slot);
+		}
+		v->v_dev = NULL;
+	}
+	dev_owner[slot] = e->env_id;
+	dev_bits[slot] = bits;
+	plic_enable(IRQ_VIRTIO0 + slot);
+	return 0;
+}
 
-	// printk("flush %d %x\n", used->idx, flush_buffer.status);
+/* Overview:
+ *   Return whether the device register at physical address 'pa' belongs to a device granted to
+ *   'e'.
+ */
+int virtio_granted(struct Env *e, u_long pa) {
+	return pa >= VIRTIO_BASE && pa < VIRTIO_END &&
+	       dev_owner[(pa - VIRTIO_BASE) / PAGE_SIZE] == e->env_id;
 }
 
-void debug_sector(struct virtio_blk_req buffer) {
-    printk("%016lx\n", ((u_long *)buffer.data)[0]);
-	printk("%016lx\n", ((u_long *)buffer.data)[1]);
-	printk("%016lx\n", ((u_long *)buffer.data)[2]);
-	printk("%016lx\n", ((u_long *)buffer.data)[3]);
-	printk("%016lx\n", ((u_long *)buffer.data)[4]);
-	printk("%016lx\n", ((u_long *)buffer.data)[5]);
-	printk("%016lx\n", ((u_long *)buffer.data)[6]);
-	printk("%016lx\n", ((u_long *)buffer.data)[7]);
-	printk("%016lx\n", ((u_long *)buffer.data)[8]);
+/* Overview:
+ *   Forget the freed env 'e' as the waiter of its block request. The request itself still
+ *   completes, since the device may be using its pages.
+ *   Devices granted to 'e' are reset, so that they stop using its pages, and may be granted
+ *   again. A disk is driven by the kernel again, as it was before the grant.
+ */
+void virtio_env_free(struct Env *e) {
+	struct Vblk_req *r = &vblk_reqs[ENVX(e->env_id)];
+
+	if (r->r_env == e) {
+		r->r_env = NULL;
+	}
+	for (u_int i = 0; i < VIRTIO_NDEV; i++) {
+		if (dev_owner[i] == e->env_id) {
+			struct Vblk *v = vblk_of_slot(i);
+
+			((struct Virtio *)VIRTIO_VA(i))->status = 0;
+			dev_owner[i] = 0;
+			if (v != NULL && vblk_init(v, i) == 0) {
+				printk("virtio: disk in slot %d taken back from %08x\n", i, e->env_id);
+			}
+		}
+	}
 }
@@ -0,0 +1 @@
+init-envs := /user_sysbench
@@ -0,0 +1 @@
+init-envs := /user_ipccall /user_notifytest /user_waittest /user_futextest /user_sleeptest
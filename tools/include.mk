@@ -5,5 +5,5 @@ ifeq ($(call lab-ge,3), true)
 endif
 
 ifeq ($(call lab-ge,5), true)
-	targets  += fsformat
+	targets  += fsformat stripe
 endif
@@ -0,0 +1,53 @@
+/*
+ * Split a disk image into the images of a volume striped over several disks (see fs/ide.c):
+ * stripe 'i' of the image goes to stripe 'i / n' of image 'i % n'.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char **argv) {
+	if (argc < 4) {
+		fprintf(stderr, "Usage: stripe <stripe-bytes> <img-file> <out-file>...\n");
+		exit(1);
+	}
+
+	long size = atol(argv[1]);
+	int n = argc - 3;
+	FILE *in = fopen(argv[2], "rb");
+	FILE *out[n];
+	char *buf = malloc(size);
+
+	if (size <= 0 || in == NULL || buf == NULL) {
+		fprintf(stderr, "stripe: cannot read '%s' by %ld bytes\n", argv[2], size);
+		exit(1);
+	}
+	for (int i = 0; i < n; i++) {
+		if ((out[i] = fopen(argv[3 + i], "wb")) == NULL) {
+			fprintf(stderr, "stripe: cannot write '%s'\n", argv[3 + i]);
+			exit(1);
+		}
+	}
+
+	// A short last stripe is padded with zeros, and so are the images left behind.
+	for (long i = 0;; i++) {
+		size_t got = fread(buf, 1, size, in);
+		if (got == 0 && i % n == 0) {
+			break;
+		}
+		for (size_t j = got; j < size; j++) {
+			buf[j] = 0;
+		}
+		if (fwrite(buf, 1, size, out[i % n]) != size) {
+			fprintf(stderr, "stripe: cannot write '%s'\n", argv[3 + i % n]);
+			exit(1);
+		}
+	}
+
+	for (int i = 0; i < n; i++) {
+		fclose(out[i]);
+	}
+	fclose(in);
+	free(buf);
+	return 0;
+}
@@ -0,0 +1,48 @@
+// Futexes: a child waits on a shared word through a second mapping of its page, and the parent
+// wakes it through the first one.
+
+#include <lib.h>
+
+#define SHARED 0x50000000
+#define ALIAS 0x50001000
+
+int main() {
+	volatile u_int *word = (volatile u_int *)SHARED;
+	u_int child;
+	int r;
+
+	if ((r = syscall_mem_alloc(0, SHARED, PTE_R | PTE_W | PTE_U | PTE_LIBRARY)) < 0) {
+		user_panic("mem_alloc: %d", r);
+	}
+	if ((r = syscall_futex_wait(word, 1, 0)) != -E_AGAIN) {
+		user_panic("futex_wait on a changed word returned %d", r);
+	}
+	if ((r = syscall_futex_wait(word, 0, 1000000L)) != -E_TIMEOUT) {
+		user_panic("futex_wait without wake returned %d", r);
+	}
+
+	if ((child = fork()) == 0) {
+		volatile u_int *alias = (volatile u_int *)ALIAS;
+		if ((r = syscall_mem_map(0, SHARED, 0, ALIAS, PTE_R | PTE_W | PTE_U | PTE_LIBRARY)) <
+		    0) {
+			user_panic("mem_map: %d", r);
+		}
+		while (*alias == 0) {
+			syscall_futex_wait(alias, 0, 0);
+		}
+		return *alias;
+	}
+
+	// Wait for the child to block.
+	while (envs[ENVX(child)].env_status != ENV_NOT_RUNNABLE) {
+		syscall_sleep(1000000L);
+	}
+	if ((r = syscall_futex_wake(word, 1, 5)) != 1) {
+		user_panic("futex_wake woke %d envs", r);
+	}
+	if ((r = wait(child)) != 5) {
+		user_panic("child exited with %d", r);
+	}
+	debugf("futextest passed\n");
+	return 0;
+}
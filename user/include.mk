@@ -9,7 +9,8 @@ USERLIB              := entry.o \
 			fork.o \
 			syscall_lib.o \
 			pageref.o \
-			ipc.o
+			ipc.o \
+			batch.o
 # pageref 提前到了 lab 4，用来调试
 
 ifeq ($(call lab-ge,5), true)
@@ -26,7 +27,13 @@ ifeq ($(call lab-ge,6), true)
 	INITAPPS     += icode.x \
 			testpipe.x \
 			testpiperace.x \
-			testptelibrary.x
+			testptelibrary.x \
+			sysbench.x \
+			ipccall.x \
+			notifytest.x \
+			waittest.x \
+			futextest.x \
+			sleeptest.x
 
 	USERLIB      += wait.o spawn.o
 	USERAPPS     := num.b  \
@@ -42,6 +49,13 @@ ifeq ($(call lab-ge,6), true)
 			testbss.b \
 			testfdsharing.b \
 			pingpong.b \
+			ipccall.b \
+			notifytest.b \
+			waittest.b \
+			futextest.b \
+			sleeptest.b \
+			top.b \
+			sysbench.b \
 			init.b
 endif
 
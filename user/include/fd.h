@@ -10,6 +10,7 @@
 #define FDTABLE (FILEBASE - LARGE_PAGE_SIZE)
 
 #define INDEX2FD(i) (FDTABLE + (i)*BY2PG)
+#define FSRINGVA (FDTABLE + MAXFD * BY2PG) // ring page shared with the file server
 #define INDEX2DATA(i) (FILEBASE + (i)*LARGE_PAGE_SIZE)
 
 // pre-declare for forward references
@@ -13,6 +13,8 @@
 #define FSREQ_DIRTY 5
 #define FSREQ_REMOVE 6
 #define FSREQ_SYNC 7
+#define FSREQ_MAP_RANGE 8
+#define FSREQ_RING 9
 #define FSREQ_DEBUG 39
 #define FSREQ_TREE 3939
 
@@ -26,6 +28,12 @@ struct Fsreq_map {
 	u_int req_offset;
 };
 
+struct Fsreq_map_range {
+	int req_fileid;
+	u_int req_offset;
+	u_int req_npages;
+};
+
 struct Fsreq_set_size {
 	int req_fileid;
 	u_int req_size;
@@ -44,4 +52,37 @@ struct Fsreq_remove {
 	char req_path[MAXPATHLEN];
 };
 
+// Submission/completion rings in a page shared by a client and the file server, registered with
+// FSREQ_RING. Each ring has a single producer and a single consumer: the client submits to 'sq'
+// and consumes 'cq', the server the other way round. Heads and tails only increase, and an
+// entry is published by a fence before the tail is bumped.
+// Only requests without a reply page (set_size, close, dirty and sync) may be submitted.
+// The notification bit posted by either side of a ring.
+#define FSRING_NOTIFY (1 << 0)
+
+#define FSRING_SIZE 64
+#define FSRING_MASK (FSRING_SIZE - 1)
+
+struct Fsring_sqe {
+	u_int sqe_op;	  // FSREQ_*
+	u_int sqe_tag;	  // copied to the completion
+	u_int sqe_req[4]; // the request, as a 'struct Fsreq_*'
+};
+
+struct Fsring_cqe {
+	u_int cqe_tag;
+	int cqe_res;
+};
+
+struct Fsring {
+	volatile u_int sq_head;	 // advanced by the server
+	volatile u_int sq_tail;	 // advanced by the client
+	volatile u_int cq_head;	 // advanced by the client
+	volatile u_int cq_tail;	 // advanced by the server
+	volatile u_int cq_wait;	 // the client sleeps in 'syscall_notify_wait' for the server
+	volatile u_int sq_stall; // the server stopped as 'cq' is full
+	struct Fsring_sqe sq[FSRING_SIZE];
+	struct Fsring_cqe cq[FSRING_SIZE];
+};
+
 #endif
@@ -20,6 +20,8 @@
 #define is_mapped(va) ((pt2[va >> VPN2_SHIFT] & PTE_V) && (pt1[va >> VPN1_SHIFT] & PTE_V) && (pt0[va >> VPN0_SHIFT] & PTE_V))
 #define is_mapped_large(va) ((pt2[va >> VPN2_SHIFT] & PTE_V) && (pt1[va >> VPN1_SHIFT] & PTE_V))
 #endif
+// Physical address of the mapped 'va', e.g. for the DMA of a device driven by the env itself.
+#define va2pa(va) (PTE2PA((u_long)pt0[(u_long)(va) >> VPN0_SHIFT]) | ((u_long)(va) & (PAGE_SIZE - 1)))
 
 void debug_hex(void *args, int n);
 void user_debug_page_user();
@@ -30,6 +32,7 @@ void user_debug_page_user();
 
 // libos
 void exit(void) __attribute__((noreturn));
+void exit_with(int status) __attribute__((noreturn));
 
 extern volatile struct Env *env;
 
@@ -60,12 +63,13 @@ int fork(void);
 
 /// syscalls
 extern int msyscall(int, ...);
+extern int msyscall_msg(int, u_long *, u_long);
 
 void syscall_putchar(int ch);
 int syscall_print_cons(const void *str, u_int num);
 u_int syscall_getenvid(void);
 void syscall_yield(void);
-int syscall_env_destroy(u_int envid);
+int syscall_env_destroy(u_int envid, int status);
 int syscall_set_tlb_mod_entry(u_int envid, void (*func)(struct Trapframe *));
 int syscall_mem_alloc(u_int envid, u_long va, u_int perm);
 int syscall_mem_map(u_int srcid, u_long srcva, u_int dstid, u_long dstva, u_int perm);
@@ -79,20 +83,60 @@ int syscall_set_env_status(u_int envid, u_int status);
 int syscall_set_trapframe(u_int envid, struct Trapframe *tf);
 void syscall_panic(const char *msg) __attribute__((noreturn));
 int syscall_ipc_try_send(u_int envid, u_int value, const u_long srcva, u_int perm);
+int syscall_ipc_send(u_int envid, u_int value, const u_long srcva, u_int perm);
 int syscall_ipc_recv(u_long dstva);
+int syscall_ipc_recv_timeout(u_long dstva, u_long ns);
+int syscall_ipc_recv_notify(u_long dstva, u_long ns, u_int notify);
+int syscall_ipc_call(u_int envid, u_int value, const u_long srcva, u_int perm, u_long dstva);
+int syscall_ipc_call_range(u_int envid, u_int value, const u_long srcva, u_int perm,
+			   u_long dstva, u_int dstnpages);
+int syscall_ipc_reply_recv(u_int envid, u_int value, const u_long srcva, u_int npages,
+			   u_int perm, u_long dstva, u_int notify, u_long *msg);
+int syscall_ipc_call_msg(u_int envid, u_long *msg);
 int syscall_cgetc();
 int syscall_write_dev(void *, u_int, u_int);
 int syscall_read_dev(void *, u_int, u_int);
-int syscall_read_sector(u_long, le64);
-int syscall_write_sector(u_long, le64);
-int syscall_flush();
+int syscall_dev_map(u_int slot, u_long va, u_int bits);
+int syscall_read_sector(u_int disk, u_long va, le64 sector, u_int nsecs);
+int syscall_write_sector(u_int disk, u_long va, le64 sector, u_int nsecs);
+int syscall_flush(u_int disk);
+int syscall_disk_info(u_int disk, struct Disk_info *info);
+int syscall_notify(u_int envid, u_int bits);
+int syscall_notify_wait(u_int mask);
+int syscall_sleep(u_long ns);
+int syscall_env_stat(u_int envid, struct Env_stat *st);
+int syscall_batch(struct Sysreq *vec, u_int n);
+int syscall_wait(u_int envid, int *status);
+int syscall_futex_wait(volatile u_int *addr, u_int expected, u_long ns);
+int syscall_futex_wake(volatile u_int *addr, u_int n, u_int val);
+
+// batch.c
+struct Batch {
+	int b_n;
+	struct Sysreq b_req[SYSREQ_MAX];
+};
+
+int batch_mem_alloc(struct Batch *b, u_int envid, u_long va, u_int perm);
+int batch_mem_map(struct Batch *b, u_int srcid, u_long srcva, u_int dstid, u_long dstva,
+		  u_int perm);
+int batch_mem_unmap(struct Batch *b, u_int envid, u_long va);
+int batch_set_env_status(struct Batch *b, u_int envid, u_int status);
+int batch_futex_wake(struct Batch *b, volatile u_int *addr, u_int n, u_int val);
+int batch_flush(struct Batch *b);
 
 // ipc.c
 void ipc_send(u_int whom, u_int val, const u_long srcva, u_int perm);
 u_int ipc_recv(u_int *whom, u_long dstva, u_int *perm);
+int ipc_recv_timeout(u_int *whom, u_int *val, u_long dstva, u_int *perm, u_long ns);
+u_int ipc_call(u_int whom, u_int val, const u_long srcva, u_int perm, u_long dstva, u_int *rperm);
+u_int ipc_call_range(u_int whom, u_int val, const u_long srcva, u_int perm, u_long dstva,
+		     u_int dstnpages, u_int *rperm);
+u_int ipc_reply_recv(u_int *whom, u_int val, const u_long srcva, u_int npages, u_int perm,
+		     u_long dstva, u_int notify, u_int *rperm, u_long *msg);
+u_int ipc_call_msg(u_int whom, u_long *msg);
 
 // wait.c
-void wait(u_int envid);
+int wait(u_int envid);
 
 // console.c
 int opencons(void);
@@ -112,9 +156,11 @@ int printf(const char *fmt, ...);
 // fsipc.c
 int fsipc_open(const char *, u_int, struct Fd *);
 int fsipc_map(u_int, u_int, u_long);
+int fsipc_map_range(u_int, u_int, u_int, u_long);
 int fsipc_set_size(u_int, u_int);
 int fsipc_close(u_int);
 int fsipc_dirty(u_int, u_int);
+int fsipc_dirty_async(u_int, u_int);
 int fsipc_remove(const char *);
 int fsipc_sync(void);
 int fsipc_incref(u_int);
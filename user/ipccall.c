@@ -0,0 +1,83 @@
+// Ping-pong with ipc_call/ipc_reply_recv, timed against ipc_send/ipc_recv, and with messages
+// carried in registers by ipc_call_msg.
+
+#include <lib.h>
+
+#define ROUNDS 10000
+#define DONE 0xffff
+
+int main() {
+	u_int who, i, perm;
+	u_long msg[IPC_MSG_WORDS];
+	uint64_t start, call, callmsg, sendrecv;
+
+	if ((who = fork()) == 0) {
+		// Server: echo back the value plus one, or the sum of the words of a message.
+		u_int r = 0;
+		who = 0;
+		for (;;) {
+			i = ipc_reply_recv(&who, r, 0, 0, 0, 0, 0, &perm, msg);
+			if (i == DONE) {
+				break;
+			}
+			r = i + 1;
+			if (perm == 0) {
+				r = 0;
+				for (int j = 1; j < IPC_MSG_WORDS; j++) {
+					r += msg[j];
+				}
+			}
+		}
+		// Reply to the last call, and switch to ipc_recv/ipc_send for the last round. A caller
+		// only takes the reply through ipc_reply_recv.
+		i = ipc_reply_recv(&who, 0, 0, 0, 0, 0, 0, &perm, msg);
+		for (;;) {
+			ipc_send(who, i + 1, 0, 0);
+			if (i == ROUNDS) {
+				return 0;
+			}
+			i = ipc_recv(&who, 0, 0);
+		}
+	}
+
+	start = timer_now();
+	for (i = 1; i <= ROUNDS; i++) {
+		u_int r = ipc_call(who, i, 0, 0, 0, 0);
+		if (r != i + 1) {
+			user_panic("ipc_call: got %d, expected %d", r, i + 1);
+		}
+	}
+	call = timer_now() - start;
+
+	start = timer_now();
+	for (i = 1; i <= ROUNDS; i++) {
+		for (int j = 0; j < IPC_MSG_WORDS; j++) {
+			msg[j] = i + j;
+		}
+		u_int r = ipc_call_msg(who, msg);
+		if (r != 5 * i + 15) {
+			user_panic("ipc_call_msg: got %d, expected %d", r, 5 * i + 15);
+		}
+	}
+	callmsg = timer_now() - start;
+
+	ipc_call(who, DONE, 0, 0, 0, 0);
+
+	start = timer_now();
+	for (i = 1; i <= ROUNDS; i++) {
+		u_int from;
+		ipc_send(who, i, 0, 0);
+		u_int r = ipc_recv(&from, 0, 0);
+		if (r != i + 1 || from != who) {
+			user_panic("ipc_recv: got %d from %x, expected %d", r, from, i + 1);
+		}
+	}
+	sendrecv = timer_now() - start;
+
+	debugf("call/reply_recv: %d ns/round trip\n", (u_int)(call * NS_PER_CYCLE / ROUNDS));
+	debugf("call_msg:        %d ns/round trip\n", (u_int)(callmsg * NS_PER_CYCLE / ROUNDS));
+	debugf("send/recv:       %d ns/round trip\n", (u_int)(sendrecv * NS_PER_CYCLE / ROUNDS));
+	wait(who);
+	debugf("ipccall passed\n");
+	return 0;
+}
@@ -0,0 +1,66 @@
+#include <lib.h>
+
+/* Overview:
+ *   Append a request to 'b', executing the queued ones first if 'b' is full.
+ *
+ * Post-Condition:
+ *   Return 0 on success, or the error of 'batch_flush' if 'b' was full.
+ */
+static int batch_add(struct Batch *b, u_long sysno, u_long a0, u_long a1, u_long a2, u_long a3,
+		     u_long a4) {
+	struct Sysreq *req;
+
+	if (b->b_n == SYSREQ_MAX) {
+		try(batch_flush(b));
+	}
+	req = &b->b_req[b->b_n++];
+	req->sr_sysno = sysno;
+	req->sr_args[0] = a0;
+	req->sr_args[1] = a1;
+	req->sr_args[2] = a2;
+	req->sr_args[3] = a3;
+	req->sr_args[4] = a4;
+	return 0;
+}
+
+int batch_mem_alloc(struct Batch *b, u_int envid, u_long va, u_int perm) {
+	return batch_add(b, SYS_mem_alloc, envid, va, perm, 0, 0);
+}
+
+int batch_mem_map(struct Batch *b, u_int srcid, u_long srcva, u_int dstid, u_long dstva,
+		  u_int perm) {
+	return batch_add(b, SYS_mem_map, srcid, srcva, dstid, dstva, perm);
+}
+
+int batch_mem_unmap(struct Batch *b, u_int envid, u_long va) {
+	return batch_add(b, SYS_mem_unmap, envid, va, 0, 0, 0);
+}
+
+int batch_set_env_status(struct Batch *b, u_int envid, u_int status) {
+	return batch_add(b, SYS_set_env_status, envid, status, 0, 0, 0);
+}
+
+int batch_futex_wake(struct Batch *b, volatile u_int *addr, u_int n, u_int val) {
+	return batch_add(b, SYS_futex_wake, (u_long)addr, n, val, 0, 0);
+}
+
+/* Overview:
+ *   Execute the requests queued in 'b' with a single 'syscall_batch', and empty 'b'.
+ *
+ * Post-Condition:
+ *   Return 0 if all requests succeeded.
+ *   Otherwise return the error of the first failed one. Requests after it are dropped.
+ */
+int batch_flush(struct Batch *b) {
+	int n = b->b_n;
+	int r;
+
+	b->b_n = 0;
+	if (n == 0) {
+		return 0;
+	}
+	if ((r = syscall_batch(b->b_req, n)) < 0) {
+		return r;
+	}
+	return r < n ? b->b_req[r].sr_ret : 0;
+}
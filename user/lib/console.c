@@ -47,9 +47,8 @@ int cons_read(struct Fd *fd, void *vbuf, u_int n, u_int offset) {
 		return 0;
 	}
 
-	while ((c = syscall_cgetc()) == 0) {
-		syscall_yield();
-	}
+	// Blocks until a character is typed.
+	c = syscall_cgetc();
 
 	if (c != '\r') {
 		debugf("%c", c);
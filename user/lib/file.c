@@ -54,12 +54,9 @@ int open(const char *path, int mode) {
 	fileid = ffd->f_fileid;
 
 	// Step 4: Alloc pages and map the file content using 'fsipc_map'.
-	for (int i = 0; i < size; i += BY2PG) {
-		/* Exercise 5.9: Your code here. (4/5) */
-		if ((r = fsipc_map(fileid, i, va + i)) < 0) {
-			return r;
-		}
-
+	// All pages are mapped with a single 'fsipc_map_range' request.
+	if (size > 0 && (r = fsipc_map_range(fileid, 0, ROUND(size, BY2PG) / BY2PG, va)) < 0) {
+		return r;
 	}
 
 	// Step 5: Return the number of file descriptor using 'fd2num'.
@@ -68,6 +65,8 @@ int open(const char *path, int mode) {
 
 }
 
+static struct Batch close_batch;
+
 // Overview:
 //  Close a file descriptor
 int file_close(struct Fd *fd) {
@@ -84,9 +83,9 @@ int file_close(struct Fd *fd) {
 	// Set the start address storing the file's content.
 	va = fd2data(fd);
 
-	// Tell the file server the dirty page.
+	// Tell the file server the dirty page. They are queued together, and served before the close.
 	for (i = 0; i < size; i += BY2PG) {
-		fsipc_dirty(fileid, i);
+		fsipc_dirty_async(fileid, i);
 	}
 
 	// Request the file server to close the file with fsipc.
@@ -100,11 +99,15 @@ int file_close(struct Fd *fd) {
 		return 0;
 	}
 	for (i = 0; i < size; i += BY2PG) {
-		if ((r = syscall_mem_unmap(0, va + i)) < 0) {
-			debugf("cannont unmap the file.\n");
-			return r;
+		if ((r = batch_mem_unmap(&close_batch, 0, va + i)) < 0) {
+			break;
 		}
 	}
+	if (r < 0 || (r = batch_flush(&close_batch)) < 0) {
+		close_batch.b_n = 0;
+		debugf("cannont unmap the file.\n");
+		return r;
+	}
 	return 0;
 }
 
@@ -233,11 +236,11 @@ int ftruncate(int fdnum, u_int size) {
 	u_long va = fd2data(fd);
 
 	// Map any new pages needed if extending the file
-	for (i = ROUND(oldsize, BY2PG); i < ROUND(size, BY2PG); i += BY2PG) {
-		if ((r = fsipc_map(fileid, i, va + i)) < 0) {
-			fsipc_set_size(fileid, oldsize);
-			return r;
-		}
+	i = ROUND(oldsize, BY2PG);
+	if (i < ROUND(size, BY2PG) &&
+	    (r = fsipc_map_range(fileid, i, (ROUND(size, BY2PG) - i) / BY2PG, va + i)) < 0) {
+		fsipc_set_size(fileid, oldsize);
+		return r;
 	}
 
 	// Unmap pages if truncating the file
@@ -92,8 +92,14 @@ static void __attribute__((noreturn)) cow_entry(struct Trapframe *tf) {
  *     kernel 'envid2env' converts '0' to 'curenv').
  *   - You should use 'syscall_mem_map', the user space wrapper around 'msyscall' to invoke
  *     'sys_mem_map' in kernel.
+ *
+ * Note:
+ *   Most mappings are only queued in 'fork_batch', which the caller should flush at last.
+ *   Return 0 on success, or the first error met.
  */
-static void duppage(u_int envid, u_int vpn) {
+static struct Batch fork_batch;
+
+static int duppage(u_int envid, u_int vpn) {
 	// int r;
 	// u_int addr;
 	u_int perm;
@@ -112,13 +118,24 @@ static void duppage(u_int envid, u_int vpn) {
 
 	// debugf("duppage %016lx %x->%x", vpn << VPN0_SHIFT, envid, env->env_id);
 	// debugf("%b\n", (perm | PTE_COW) & ~PTE_W);
-	if (!(perm & PTE_U)) {
-		syscall_mem_map(0, vpn << VPN0_SHIFT, envid, vpn << VPN0_SHIFT, perm);
+	// The mappings are queued in 'fork_batch' and done by 'batch_flush' together. The kernel writes
+	// the results back to 'fork_batch', so the pages holding it are mapped right away instead:
+	// once they are copy-on-write, only a later write by us would make them writable again.
+	u_long va = vpn << VPN0_SHIFT;
+	if (va + PAGE_SIZE > (u_long)&fork_batch && va < (u_long)(&fork_batch + 1)) {
+		try(batch_flush(&fork_batch));
+		if ((perm & PTE_U) && (perm & PTE_W) && !(perm & PTE_LIBRARY)) {
+			try(syscall_mem_map(0, va, envid, va, (perm | PTE_COW) & ~PTE_W));
+			return syscall_mem_map(0, va, 0, va, (perm | PTE_COW) & ~PTE_W);
+		}
+		return syscall_mem_map(0, va, envid, va, perm);
+	} else if (!(perm & PTE_U)) {
+		return batch_mem_map(&fork_batch, 0, va, envid, va, perm);
 	} else if ((perm & PTE_W) && !(perm & PTE_LIBRARY)) {
-		syscall_mem_map(0, vpn << VPN0_SHIFT, envid, vpn << VPN0_SHIFT, (perm | PTE_COW) & ~PTE_W);
-		syscall_mem_map(0, vpn << VPN0_SHIFT, 0, vpn << VPN0_SHIFT, (perm | PTE_COW) & ~PTE_W);
+		try(batch_mem_map(&fork_batch, 0, va, envid, va, (perm | PTE_COW) & ~PTE_W));
+		return batch_mem_map(&fork_batch, 0, va, 0, va, (perm | PTE_COW) & ~PTE_W);
 	} else {
-		syscall_mem_map(0, vpn << VPN0_SHIFT, envid, vpn << VPN0_SHIFT, perm);
+		return batch_mem_map(&fork_batch, 0, va, envid, va, perm);
 	}
 	// debugf("end\n");
 
@@ -137,6 +154,7 @@ static void duppage(u_int envid, u_int vpn) {
  */
 int fork(void) {
 	u_int child;
+	int r;
 	// u_int i;
 	extern volatile struct Env *env;
 
@@ -169,7 +187,9 @@ int fork(void) {
 	for (u_long va = 0; va < USTACKTOP; va += PAGE_SIZE) {
 		if (pt1[va >> VPN1_SHIFT] & PTE_V) {
 			if (pt0[va >> VPN0_SHIFT] & PTE_V) {
-				duppage(child, va >> VPN0_SHIFT);
+				if ((r = duppage(child, va >> VPN0_SHIFT)) < 0) {
+					goto err;
+				}
 			}
 		}
 	}
@@ -178,7 +198,9 @@ int fork(void) {
 		if (pt2[va >> VPN2_SHIFT] & PTE_V) {			// 一旦进入必须写时复制，但是必须进入才能写时复制，矛盾
 			if (pt1[va >> VPN1_SHIFT] & PTE_V) {
 				if (pt0[va >> VPN0_SHIFT] & PTE_V) {	// 内核在 exofork 内 duppage，这样能够实现快速的映射
-					duppage(child, va >> VPN0_SHIFT);	// 页表和 env，pages 都是在 exofork 内映射
+					if ((r = duppage(child, va >> VPN0_SHIFT)) < 0) { // 页表和 env，pages 都是在 exofork 内映射
+						goto err;
+					}
 				}
 			}
 		}
@@ -194,10 +216,18 @@ int fork(void) {
 	/* Exercise 4.15: Your code here. (2/2) */
 	if (child) {
 		syscall_set_tlb_mod_entry(child, cow_entry);
-		syscall_set_env_status(child, ENV_RUNNABLE);
+		if ((r = batch_set_env_status(&fork_batch, child, ENV_RUNNABLE)) < 0 ||
+		    (r = batch_flush(&fork_batch)) < 0) {
+			goto err;
+		}
 	}
 
 	return child;
+
+err:
+	fork_batch.b_n = 0;
+	syscall_env_destroy(child, 0);
+	return r;
 }
 
 static void _debug_page(u_long va, u_long pte) {
@@ -20,10 +20,143 @@ u_char fsipcbuf[BY2PG] __attribute__((aligned(BY2PG)));
 //  0 if successful,
 //  < 0 on failure.
 static int fsipc(u_int type, void *fsreq, void *dstva, u_int *perm) {
-	u_int whom;
 	// Our file system server must be the 2nd env.
-	ipc_send(envs[1].env_id, type, (u_long)fsreq, PTE_R | PTE_W | PTE_U);
-	return ipc_recv(&whom, (u_long)dstva, perm);
+	return ipc_call(envs[FS_SERV_ENVX].env_id, type, (u_long)fsreq, PTE_R | PTE_W | PTE_U, (u_long)dstva,
+			perm);
+}
+
+// Overview:
+//  Like fsipc, but the reply may map a range of up to 'npages' pages from 'dstva' on.
+static int fsipc_range(u_int type, void *fsreq, void *dstva, u_int npages, u_int *perm) {
+	return ipc_call_range(envs[FS_SERV_ENVX].env_id, type, (u_long)fsreq, PTE_R | PTE_W | PTE_U,
+			      (u_long)dstva, npages, perm);
+}
+
+// Overview:
+//  Like fsipc, but carry the request 'fsreq' of 'size' bytes in registers with ipc_call_msg,
+//  skipping the page mapping for small requests with no reply page.
+static int fsipc_msg(u_int type, const void *fsreq, u_int size) {
+	u_long msg[IPC_MSG_WORDS] = {type};
+
+	user_assert(size <= sizeof(msg) - sizeof(msg[0]));
+	memcpy(&msg[1], fsreq, size);
+	return ipc_call_msg(envs[FS_SERV_ENVX].env_id, msg);
+}
+
+// The ring page shared with the file server. It is PTE_LIBRARY so that it stays shared after
+// fork, and a forked or spawned child (not being 'fsring_owner') sets up a fresh page of its own.
+static struct Fsring *const fsring = (struct Fsring *)FSRINGVA;
+static u_int fsring_owner;
+static u_int fsring_tag;
+
+// Overview:
+//  Register the ring of this env with the file server, if not yet.
+//
+// Returns:
+//  0 on success,
+//  < 0 on failure, in which case the requests go through fsipc_msg.
+static int fsring_setup(void) {
+	int r;
+
+	if (fsring_owner == env->env_id) {
+		return 0;
+	}
+	if ((r = syscall_mem_alloc(0, FSRINGVA, PTE_R | PTE_W | PTE_U | PTE_LIBRARY)) < 0) {
+		return r;
+	}
+	if ((r = fsipc(FSREQ_RING, fsring, 0, 0)) < 0) {
+		return r;
+	}
+	fsring_owner = env->env_id;
+	fsring_tag = 0;
+	return 0;
+}
+
+// Overview:
+//  Consume all completions, storing the result of 'tag' (if found) to '*res'.
+//  Wake up the server if it stopped for a full completion ring.
+static int fsring_reap(u_int tag, int *res) {
+	int found = 0;
+
+	while (fsring->cq_head != fsring->cq_tail) {
+		__sync_synchronize();
+		struct Fsring_cqe *cqe = &fsring->cq[fsring->cq_head & FSRING_MASK];
+		if (tag != 0 && cqe->cqe_tag == tag) {
+			*res = cqe->cqe_res;
+			found = 1;
+		}
+		__sync_synchronize();
+		fsring->cq_head++;
+	}
+	if (fsring->sq_stall) {
+		fsring->sq_stall = 0;
+		syscall_notify(envs[FS_SERV_ENVX].env_id, FSRING_NOTIFY);
+	}
+	return found;
+}
+
+// Overview:
+//  Sleep until the server has made progress on our ring. The flag and the rings are checked again
+//  after 'cq_wait' is set, so that a wakeup sent in between is not lost.
+static void fsring_sleep(void) {
+	fsring->cq_wait = 1;
+	__sync_synchronize();
+	if (fsring->cq_head == fsring->cq_tail && !fsring->sq_stall) {
+		syscall_notify_wait(FSRING_NOTIFY);
+	}
+	fsring->cq_wait = 0;
+}
+
+// Overview:
+//  Submit the request 'fsreq' of 'size' bytes to the ring, without waiting for its completion.
+//  The server is only notified when the ring goes from empty to non-empty.
+//
+// Returns:
+//  the tag of the submission.
+static u_int fsring_submit(u_int type, const void *fsreq, u_int size) {
+	u_int tail = fsring->sq_tail;
+	struct Fsring_sqe *sqe;
+	int res;
+
+	user_assert(size <= sizeof(sqe->sqe_req));
+	while (tail - fsring->sq_head == FSRING_SIZE) {
+		fsring_reap(0, &res);
+		if (tail - fsring->sq_head == FSRING_SIZE) {
+			fsring_sleep();
+		}
+	}
+
+	if (++fsring_tag == 0) {
+		fsring_tag = 1;
+	}
+	sqe = &fsring->sq[tail & FSRING_MASK];
+	sqe->sqe_op = type;
+	sqe->sqe_tag = fsring_tag;
+	memcpy(sqe->sqe_req, fsreq, size);
+	__sync_synchronize();
+	fsring->sq_tail = tail + 1;
+	__sync_synchronize();
+	if (fsring->sq_head == tail) {
+		syscall_notify(envs[FS_SERV_ENVX].env_id, FSRING_NOTIFY);
+	}
+	return fsring_tag;
+}
+
+// Overview:
+//  Submit the request 'fsreq' of 'size' bytes to the ring and wait for its result.
+//  Requests go in order with those submitted earlier by 'fsring_submit'.
+static int fsring_call(u_int type, const void *fsreq, u_int size) {
+	u_int tag;
+	int res;
+
+	if (fsring_setup() < 0) {
+		return fsipc_msg(type, fsreq, size);
+	}
+	tag = fsring_submit(type, fsreq, size);
+	while (!fsring_reap(tag, &res)) {
+		fsring_sleep();
+	}
+	return res;
 }
 
 // Overview:
@@ -77,36 +210,75 @@ int fsipc_map(u_int fileid, u_int offset, u_long dstva) {
 	return 0;
 }
 
+// Overview:
+//  Like fsipc_map, but map the 'npages' blocks from 'offset' on to 'dstva' with one request.
+//
+// Returns:
+//  0 on success,
+//  < 0 on failure.
+int fsipc_map_range(u_int fileid, u_int offset, u_int npages, u_long dstva) {
+	int r;
+	u_int perm;
+	struct Fsreq_map_range *req;
+
+	req = (struct Fsreq_map_range *)fsipcbuf;
+	req->req_fileid = fileid;
+	req->req_offset = offset;
+	req->req_npages = npages;
+
+	if ((r = fsipc_range(FSREQ_MAP_RANGE, req, (void *)dstva, npages, &perm)) < 0) {
+		return r;
+	}
+
+	if ((perm & ~(PTE_R | PTE_W | PTE_U | PTE_LIBRARY)) != (PTE_V)) {
+		user_panic("fsipc_map_range: unexpected permissions %08x for dstva %08x", perm, dstva);
+	}
+
+	return 0;
+}
+
 // Overview:
 //  Make a set-file-size request to the file server.
 int fsipc_set_size(u_int fileid, u_int size) {
-	struct Fsreq_set_size *req;
+	struct Fsreq_set_size req;
 
-	req = (struct Fsreq_set_size *)fsipcbuf;
-	req->req_fileid = fileid;
-	req->req_size = size;
-	return fsipc(FSREQ_SET_SIZE, req, 0, 0);
+	req.req_fileid = fileid;
+	req.req_size = size;
+	return fsring_call(FSREQ_SET_SIZE, &req, sizeof(req));
 }
 
 // Overview:
 //  Make a file-close request to the file server. After this the fileid is invalid.
 int fsipc_close(u_int fileid) {
-	struct Fsreq_close *req;
+	struct Fsreq_close req;
 
-	req = (struct Fsreq_close *)fsipcbuf;
-	req->req_fileid = fileid;
-	return fsipc(FSREQ_CLOSE, req, 0, 0);
+	req.req_fileid = fileid;
+	return fsring_call(FSREQ_CLOSE, &req, sizeof(req));
 }
 
 // Overview:
 //  Ask the file server to mark a particular file block dirty.
 int fsipc_dirty(u_int fileid, u_int offset) {
-	struct Fsreq_dirty *req;
+	struct Fsreq_dirty req;
 
-	req = (struct Fsreq_dirty *)fsipcbuf;
-	req->req_fileid = fileid;
-	req->req_offset = offset;
-	return fsipc(FSREQ_DIRTY, req, 0, 0);
+	req.req_fileid = fileid;
+	req.req_offset = offset;
+	return fsring_call(FSREQ_DIRTY, &req, sizeof(req));
+}
+
+// Overview:
+//  Like fsipc_dirty, but only queue the request in the ring without waiting for it. Its result
+//  is dropped, and requests made later through the ring are served after it.
+int fsipc_dirty_async(u_int fileid, u_int offset) {
+	struct Fsreq_dirty req;
+
+	req.req_fileid = fileid;
+	req.req_offset = offset;
+	if (fsring_setup() < 0) {
+		return fsipc_msg(FSREQ_DIRTY, &req, sizeof(req));
+	}
+	fsring_submit(FSREQ_DIRTY, &req, sizeof(req));
+	return 0;
 }
 
 // Overview:
@@ -137,7 +309,7 @@ int fsipc_remove(const char *path) {
 //  Ask the file server to update the disk by writing any dirty
 //  blocks in the buffer cache.
 int fsipc_sync(void) {
-	return fsipc(FSREQ_SYNC, fsipcbuf, 0, 0);
+	return fsring_call(FSREQ_SYNC, NULL, 0);
 }
 
 int fsipc_debug(const char *path) {
@@ -151,5 +323,5 @@ int fsipc_debug(const char *path) {
 }
 
 int fsipc_tree(void) {
-	return fsipc(FSREQ_TREE, fsipcbuf, 0, 0);
+	return fsipc_msg(FSREQ_TREE, NULL, 0);
 }
@@ -4,16 +4,10 @@
 #include <lib.h>
 #include <mmu.h>
 
-// Send val to whom.  This function keeps trying until
-// it succeeds.  It should panic() on any error other than
-// -E_IPC_NOT_RECV.
-//
-// Hint: use syscall_yield() to be CPU-friendly.
+// Send val to whom.  This function blocks in the kernel until
+// whom receives it.  It panics on any error.
 void ipc_send(u_int whom, u_int val, const u_long srcva, u_int perm) {
-	int r;
-	while ((r = syscall_ipc_try_send(whom, val, srcva, perm)) == -E_IPC_NOT_RECV) {
-		syscall_yield();
-	}
+	int r = syscall_ipc_send(whom, val, srcva, perm);
 	user_assert(r == 0);
 }
 
@@ -37,3 +31,92 @@ u_int ipc_recv(u_int *whom, u_long dstva, u_int *perm) {
 
 	return env->env_ipc_value;
 }
+
+// Like ipc_recv, but give up after 'ns' nanoseconds (0 means to wait forever).
+// Return 0 and store the value in *val on success, or -E_TIMEOUT if nothing is received in time.
+int ipc_recv_timeout(u_int *whom, u_int *val, u_long dstva, u_int *perm, u_long ns) {
+	int r = syscall_ipc_recv_timeout(dstva, ns);
+	if (r == -E_TIMEOUT) {
+		return r;
+	}
+	if (r != 0) {
+		user_panic("syscall_ipc_recv err: %d", r);
+	}
+
+	if (whom) {
+		*whom = env->env_ipc_from;
+	}
+
+	if (perm) {
+		*perm = env->env_ipc_perm;
+	}
+
+	if (val) {
+		*val = env->env_ipc_value;
+	}
+
+	return 0;
+}
+
+// Send val to whom and wait for its reply, which is returned.  The reply page (if any) is
+// received at dstva with its permission stored in *rperm.  It panics on any error.
+u_int ipc_call(u_int whom, u_int val, const u_long srcva, u_int perm, u_long dstva, u_int *rperm) {
+	int r = syscall_ipc_call(whom, val, srcva, perm, dstva);
+	if (r != 0) {
+		user_panic("syscall_ipc_call err: %d", r);
+	}
+
+	if (rperm) {
+		*rperm = env->env_ipc_perm;
+	}
+
+	return env->env_ipc_value;
+}
+
+// Like ipc_call, but the reply may carry a range of up to dstnpages pages, mapped from dstva on.
+u_int ipc_call_range(u_int whom, u_int val, const u_long srcva, u_int perm, u_long dstva,
+		     u_int dstnpages, u_int *rperm) {
+	int r = syscall_ipc_call_range(whom, val, srcva, perm, dstva, dstnpages);
+	if (r != 0) {
+		user_panic("syscall_ipc_call err: %d", r);
+	}
+
+	if (rperm) {
+		*rperm = env->env_ipc_perm;
+	}
+
+	return env->env_ipc_value;
+}
+
+// Reply val (with the npages pages at srcva if it is not 0) to *whom (if not 0), then receive
+// the next value like ipc_recv, storing its sender in *whom.  Used by servers to answer a request
+// and wait for the next in one syscall.  Notification bits in notify are received as a value
+// from envid 0.
+// If msg is not NULL, the words of a message sent by ipc_call_msg are stored there, which is
+// told by *rperm being 0.
+u_int ipc_reply_recv(u_int *whom, u_int val, const u_long srcva, u_int npages, u_int perm,
+		     u_long dstva, u_int notify, u_int *rperm, u_long *msg) {
+	int r = syscall_ipc_reply_recv(*whom, val, srcva, npages, perm, dstva, notify, msg);
+	if (r != 0) {
+		user_panic("syscall_ipc_reply_recv err: %d", r);
+	}
+
+	*whom = env->env_ipc_from;
+
+	if (rperm) {
+		*rperm = env->env_ipc_perm;
+	}
+
+	return env->env_ipc_value;
+}
+
+// Send the IPC_MSG_WORDS words of msg to whom in registers, without any page, and wait for
+// its reply, whose words replace msg.  Return the reply value (msg[0]).  It panics on any error.
+u_int ipc_call_msg(u_int whom, u_long *msg) {
+	int r = syscall_ipc_call_msg(whom, msg);
+	if (r != 0) {
+		user_panic("syscall_ipc_call_msg err: %d", r);
+	}
+
+	return msg[0];
+}
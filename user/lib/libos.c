@@ -2,16 +2,21 @@
 #include <lib.h>
 #include <mmu.h>
 
-void exit(void) {
+// Exit with 'status', which is returned by 'wait' in the envs waiting for us.
+void exit_with(int status) {
 	// After fs is ready (lab5), all our open files should be closed before dying.
 #if !defined(LAB) || LAB >= 5
 	close_all();
 #endif
 
-	syscall_env_destroy(0);
+	syscall_env_destroy(0, status);
 	user_panic("unreachable code");
 }
 
+void exit(void) {
+	exit_with(0);
+}
+
 volatile struct Env *env;
 extern int main(int, char **);
 
@@ -41,9 +46,6 @@ void libmain(int argc, char **argv) {
 	#endif
 	#endif
 
-	// call user main routine
-	main(argc, argv);
-
-	// exit gracefully
-	exit();
+	// call user main routine, and exit gracefully with its return value
+	exit_with(main(argc, argv));
 }
@@ -22,9 +22,41 @@ struct Dev devpipe = {
 struct Pipe {
 	u_int p_rpos;	       // read position
 	u_int p_wpos;	       // write position
+	u_int p_rwait;	       // a reader may be blocked on it
+	u_int p_wwait;	       // a writer may be blocked on it
 	u_char p_buf[BY2PIPE]; // data buffer
 };
 
+static volatile int _pipe_is_closed(struct Fd *fd, struct Pipe *p);
+
+/* Overview:
+ *   Block until the position 'pos' no longer holds 'old' or the pipe is closed, on the flag
+ *   'wait', which tells the other end to call 'pipe_wake'. Wakeups may be spurious.
+ *
+ * Note:
+ *   The flag is set before 'pos' and the close are checked again, so that the other end either
+ *   sees it set, or changed 'pos' or closed before the check. 'pipe_wake' and 'pipe_close' clear it
+ *   along with the wakeup, so that a wakeup in between makes 'syscall_futex_wait' return at once.
+ */
+static void pipe_sleep(struct Fd *fd, struct Pipe *p, volatile u_int *wait, volatile u_int *pos,
+		       u_int old) {
+	*wait = 1;
+	__sync_synchronize();
+	if (*pos == old && !_pipe_is_closed(fd, p)) {
+		syscall_futex_wait(wait, 1, 0);
+	}
+}
+
+/* Overview:
+ *   Wake up the other end blocked by 'pipe_sleep' on the flag 'wait', if it may be.
+ */
+static void pipe_wake(volatile u_int *wait) {
+	__sync_synchronize();
+	if (*wait) {
+		syscall_futex_wake(wait, NENV, 0);
+	}
+}
+
 /* Overview:
  *   Create a pipe.
  *
@@ -149,16 +181,19 @@ static int pipe_read(struct Fd *fd, void *vbuf, u_int n, u_int offset) {
 	// When the pipe buffer is empty:
 	//  - If at least 1 byte is read, or the pipe is closed, just return the number
 	//    of bytes read so far.
-	//  - Otherwise, keep yielding until the buffer isn't empty or the pipe is closed.
+	//  - Otherwise, keep blocking until the buffer isn't empty or the pipe is closed.
 	/* Exercise 6.1: Your code here. (2/3) */
 	p = (struct Pipe *)fd2data(fd);
 	rbuf = (char *)vbuf;
 	for (i = 0; i < n; i++) {
 		while (p->p_wpos == p->p_rpos) { // empty
 			if (_pipe_is_closed(fd, p)) {
+				pipe_wake(&p->p_wwait);
 				return i;
 			} else {
-				syscall_yield();
+				// The writer may be blocked on the space freed so far.
+				pipe_wake(&p->p_wwait);
+				pipe_sleep(fd, p, &p->p_rwait, &p->p_wpos, p->p_rpos);
 			}
 		}
 		*rbuf++ = p->p_buf[p->p_rpos++];
@@ -167,6 +202,7 @@ static int pipe_read(struct Fd *fd, void *vbuf, u_int n, u_int offset) {
 		}
 	}
 
+	pipe_wake(&p->p_wwait);
 	return n;
 
 	user_panic("pipe_read not implemented");
@@ -194,17 +230,24 @@ static int pipe_write(struct Fd *fd, const void *vbuf, u_int n, u_int offset) {
 	// Check if the pipe is closed by '_pipe_is_closed'.
 	// When the pipe buffer is full:
 	//  - If the pipe is closed, just return the number of bytes written so far.
-	//  - If the pipe isn't closed, keep yielding until the buffer isn't full or the
+	//  - If the pipe isn't closed, keep blocking until the buffer isn't full or the
 	//    pipe is closed.
 	/* Exercise 6.1: Your code here. (3/3) */
 	p = (struct Pipe *)fd2data(fd);
 	wbuf = (char *)vbuf;
 	for (i = 0; i < n; i++) {
-		while ((p->p_wpos + 1 == p->p_rpos) || (p->p_wpos == BY2PIPE - 1 && p->p_rpos == 0)) { // full
+		// The read position found full is the one slept on, so that a read in between is not
+		// missed.
+		u_int rpos;
+		while (rpos = p->p_rpos,
+		       (p->p_wpos + 1 == rpos) || (p->p_wpos == BY2PIPE - 1 && rpos == 0)) { // full
 			if (_pipe_is_closed(fd, p)) {
+				pipe_wake(&p->p_rwait);
 				return i;
 			} else {
-				syscall_yield();
+				// The reader may be blocked on the bytes written so far.
+				pipe_wake(&p->p_rwait);
+				pipe_sleep(fd, p, &p->p_wwait, &p->p_rpos, rpos);
 			}
 		}
 		p->p_buf[p->p_wpos++] = *wbuf++;
@@ -213,6 +256,7 @@ static int pipe_write(struct Fd *fd, const void *vbuf, u_int n, u_int offset) {
 		}
 	}
 
+	pipe_wake(&p->p_rwait);
 	return n;
 
 	user_panic("pipe_write not implemented");
@@ -246,6 +290,8 @@ int pipe_is_closed(int fdnum) {
 	return _pipe_is_closed(fd, p);
 }
 
+static struct Batch close_batch;
+
 /* Overview:
  *   Close the pipe referred by 'fd'.
  *
@@ -254,11 +300,22 @@ int pipe_is_closed(int fdnum) {
  *
  * Hint:
  *   Use 'syscall_mem_unmap' to unmap the pages.
+ *
+ * Note:
+ *   The other end blocked in 'pipe_read' or 'pipe_write' is woken up to notice the close. The flags
+ *   are cleared and the waiters woken up in the same 'sys_batch' as the Pipe is unmapped, so that
+ *   an env that found the pipe open either blocked before and is woken up, or finds its flag
+ *   cleared and checks again.
  */
 static int pipe_close(struct Fd *fd) {
+	struct Pipe *p = (struct Pipe *)fd2data(fd);
+
 	// Unmap 'fd' and the referred Pipe.
-	syscall_mem_unmap(0, (u_long)fd);
-	syscall_mem_unmap(0, (u_long)fd2data(fd));
+	batch_mem_unmap(&close_batch, 0, (u_long)fd);
+	batch_futex_wake(&close_batch, &p->p_rwait, NENV, 0);
+	batch_futex_wake(&close_batch, &p->p_wwait, NENV, 0);
+	batch_mem_unmap(&close_batch, 0, (u_long)p);
+	batch_flush(&close_batch);
 	return 0;
 }
 
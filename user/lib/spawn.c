@@ -117,6 +117,8 @@ void debug_Ehdr(char *elfbuf) {
 	debugf("\n");
 }
 
+static struct Batch spawn_batch;
+
 int spawn(char *prog, char **argv) {
 	// Step 1: Open the file 'prog' (the path of the program).
 	// Return the error if 'open' fails.
@@ -251,12 +253,14 @@ int spawn(char *prog, char **argv) {
 		goto err2;
 	}
 
-	// Pages with 'PTE_LIBRARY' set are shared between the parent and the child.
+	// Pages with 'PTE_LIBRARY' set are shared between the parent and the child. The mappings are
+	// done together with setting the child runnable, in one 'syscall_batch'.
 	for (int va = 0; va < USTACKTOP; va += PAGE_SIZE) {
 		if (is_mapped(va)) {
 			if ((pt0[va >> VPN0_SHIFT] & PTE_LIBRARY)) { // 仅 duppage 共享页面
-				if ((r = syscall_mem_map(0, va, child, va, pt0[va >> VPN0_SHIFT] & PTE_PERM)) < 0) {
-					debugf("spawn: syscall_mem_map %x %x: %d\n", va, child, r);
+				if ((r = batch_mem_map(&spawn_batch, 0, va, child, va,
+						       pt0[va >> VPN0_SHIFT] & PTE_PERM)) < 0) {
+					debugf("spawn: batch_mem_map %x %x: %d\n", va, child, r);
 					goto err2;
 				}
 			}
@@ -281,17 +285,19 @@ int spawn(char *prog, char **argv) {
 	// 	}
 	// }
 
-	if ((r = syscall_set_env_status(child, ENV_RUNNABLE)) < 0) {
-		debugf("spawn: syscall_set_env_status %x: %d\n", child, r);
+	if ((r = batch_set_env_status(&spawn_batch, child, ENV_RUNNABLE)) < 0 ||
+	    (r = batch_flush(&spawn_batch)) < 0) {
+		debugf("spawn: batch_flush %x: %d\n", child, r);
 		goto err2;
 	}
 	return child;
 
 err2:
-	syscall_env_destroy(child);
+	spawn_batch.b_n = 0;
+	syscall_env_destroy(child, 0);
 	return r;
 err1:
-	syscall_env_destroy(child);
+	syscall_env_destroy(child, 0);
 err:
 	close(fd);
 	return r;
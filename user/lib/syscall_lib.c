@@ -20,8 +20,8 @@ void syscall_yield(void) {
 	msyscall(SYS_yield);
 }
 
-int syscall_env_destroy(u_int envid) {
-	return msyscall(SYS_env_destroy, envid);
+int syscall_env_destroy(u_int envid, int status) {
+	return msyscall(SYS_env_destroy, envid, status);
 }
 
 int syscall_set_tlb_mod_entry(u_int envid, void (*func)(struct Trapframe *)) {
@@ -57,22 +57,120 @@ int syscall_ipc_try_send(u_int envid, u_int value, const u_long srcva, u_int per
 	return msyscall(SYS_ipc_try_send, envid, value, srcva, perm);
 }
 
+int syscall_ipc_send(u_int envid, u_int value, const u_long srcva, u_int perm) {
+	return msyscall(SYS_ipc_send, envid, value, srcva, perm);
+}
+
 int syscall_ipc_recv(u_long dstva) {
-	return msyscall(SYS_ipc_recv, dstva);
+	return msyscall(SYS_ipc_recv, dstva, 0, 0);
+}
+
+int syscall_ipc_recv_timeout(u_long dstva, u_long ns) {
+	return msyscall(SYS_ipc_recv, dstva, ns, 0);
+}
+
+// Also take the notification bits in 'notify', received as a message from envid 0.
+int syscall_ipc_recv_notify(u_long dstva, u_long ns, u_int notify) {
+	return msyscall(SYS_ipc_recv, dstva, ns, notify);
 }
 
 int syscall_cgetc() {
 	return msyscall(SYS_cgetc);
 }
 
-int syscall_read_sector(u_long va, le64 sector) {
-	return msyscall(SYS_read_sector, va, sector);
+int syscall_write_dev(void *va, u_int pa, u_int len) {
+	return msyscall(SYS_write_dev, va, pa, len);
+}
+
+int syscall_read_dev(void *va, u_int pa, u_int len) {
+	return msyscall(SYS_read_dev, va, pa, len);
+}
+
+int syscall_dev_map(u_int slot, u_long va, u_int bits) {
+	return msyscall(SYS_dev_map, slot, va, bits);
+}
+
+int syscall_read_sector(u_int disk, u_long va, le64 sector, u_int nsecs) {
+	return msyscall(SYS_read_sector, disk, va, sector, nsecs);
+}
+
+int syscall_write_sector(u_int disk, u_long va, le64 sector, u_int nsecs) {
+	return msyscall(SYS_write_sector, disk, va, sector, nsecs);
+}
+
+int syscall_flush(u_int disk) {
+	return msyscall(SYS_flush, disk);
+}
+
+int syscall_disk_info(u_int disk, struct Disk_info *info) {
+	return msyscall(SYS_disk_info, disk, info);
+}
+
+int syscall_ipc_call(u_int envid, u_int value, const u_long srcva, u_int perm, u_long dstva) {
+	return msyscall(SYS_ipc_call, envid, value, srcva, perm, dstva, 1);
 }
 
-int syscall_write_sector(u_long va, le64 sector) {
-	return msyscall(SYS_write_sector, va, sector);
+int syscall_ipc_call_range(u_int envid, u_int value, const u_long srcva, u_int perm,
+			   u_long dstva, u_int dstnpages) {
+	return msyscall(SYS_ipc_call, envid, value, srcva, perm, dstva, dstnpages);
 }
 
-int syscall_flush() {
-	return msyscall(SYS_flush);
+// The words of the message received are stored to 'msg' if it is not NULL.
+int syscall_ipc_reply_recv(u_int envid, u_int value, const u_long srcva, u_int npages,
+			   u_int perm, u_long dstva, u_int notify, u_long *msg) {
+	if (msg == NULL) {
+		return msyscall(SYS_ipc_reply_recv, envid, value, srcva, perm, dstva, npages, notify);
+	}
+	msg[0] = envid;
+	msg[1] = value;
+	msg[2] = srcva;
+	msg[3] = perm;
+	msg[4] = dstva;
+	msg[5] = npages;
+	return msyscall_msg(SYS_ipc_reply_recv, msg, notify);
+}
+
+// 'msg' is replaced by the words of the reply.
+int syscall_ipc_call_msg(u_int envid, u_long *msg) {
+	return msyscall_msg(SYS_ipc_call_msg, msg, envid);
+}
+
+int syscall_notify(u_int envid, u_int bits) {
+	return msyscall(SYS_notify, envid, bits);
+}
+
+int syscall_notify_wait(u_int mask) {
+	return msyscall(SYS_notify_wait, mask);
+}
+
+int syscall_sleep(u_long ns) {
+	return msyscall(SYS_sleep, ns);
+}
+
+int syscall_env_stat(u_int envid, struct Env_stat *st) {
+	return msyscall(SYS_env_stat, envid, st);
+}
+
+int syscall_batch(struct Sysreq *vec, u_int n) {
+	return msyscall(SYS_batch, vec, n);
+}
+
+int syscall_futex_wait(volatile u_int *addr, u_int expected, u_long ns) {
+	return msyscall(SYS_futex_wait, addr, expected, ns);
+}
+
+int syscall_futex_wake(volatile u_int *addr, u_int n, u_int val) {
+	return msyscall(SYS_futex_wake, addr, n, val);
+}
+
+int syscall_wait(u_int envid, int *status) {
+	int r = msyscall(SYS_wait, envid);
+
+	if (r < 0) {
+		return r;
+	}
+	if (status) {
+		*status = r;
+	}
+	return 0;
 }
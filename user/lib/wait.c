@@ -1,10 +1,17 @@
 #include <env.h>
 #include <lib.h>
-void wait(u_int envid) {
-	volatile struct Env *e;
 
-	e = &envs[ENVX(envid)];
-	while (e->env_id == envid && e->env_status != ENV_FREE) {
-		syscall_yield();
-	}
+/* Overview:
+ *   Block until the env 'envid' exits, without using the CPU meanwhile.
+ *
+ * Post-Condition:
+ *   Return the exit status of 'envid' (the value returned by its 'main' or given to 'exit_with',
+ *   truncated to 'EXIT_STATUS_MASK').
+ *   Return -E_BAD_ENV if 'envid' has exited too long ago for its status to be known.
+ */
+int wait(u_int envid) {
+	int status;
+
+	try(syscall_wait(envid, &status));
+	return status;
 }
@@ -0,0 +1,34 @@
+// Notification bits: wait on a mask, leave other bits pending, and take them with ipc_recv.
+
+#include <lib.h>
+
+int main() {
+	u_int parent = syscall_getenvid(), child;
+	int r;
+
+	if ((child = fork()) == 0) {
+		syscall_notify(parent, 1 | 4);
+		syscall_sleep(10000000L);
+		syscall_notify(parent, 8);
+		return 0;
+	}
+
+	if ((r = syscall_notify_wait(1)) != 1) {
+		user_panic("notify_wait(1) returned %d", r);
+	}
+	// Bit 4 is still pending, so this does not block.
+	if ((r = syscall_notify_wait(4 | 2)) != 4) {
+		user_panic("notify_wait(6) returned %d", r);
+	}
+	// Bit 8 comes while receiving.
+	if ((r = syscall_ipc_recv_notify(0, 0, 8)) != 0 || env->env_ipc_from != 0 ||
+	    env->env_ipc_value != 8) {
+		user_panic("ipc_recv got %d from %x with %d", r, env->env_ipc_from, env->env_ipc_value);
+	}
+	if (syscall_notify(parent, 1u << 31) != -E_INVAL) {
+		user_panic("the reserved bit is accepted");
+	}
+	wait(child);
+	debugf("notifytest passed\n");
+	return 0;
+}
@@ -0,0 +1,31 @@
+// Sleep, and time out a blocking ipc_recv.
+
+#include <lib.h>
+
+int main() {
+	u_int who, i;
+	int r;
+
+	debugf("%x sleeps 100 ms\n", syscall_getenvid());
+	syscall_sleep(100000000L);
+	debugf("%x wakes up\n", syscall_getenvid());
+
+	r = ipc_recv_timeout(&who, &i, 0, 0, 50000000L);
+	if (r != -E_TIMEOUT) {
+		user_panic("ipc_recv_timeout returned %d, expected %d", r, -E_TIMEOUT);
+	}
+	debugf("ipc_recv timed out\n");
+
+	if ((who = fork()) == 0) {
+		syscall_sleep(10000000L);
+		ipc_send(env->env_parent_id, 39, 0, 0);
+		return 0;
+	}
+	r = ipc_recv_timeout(&who, &i, 0, 0, 1000000000L);
+	if (r != 0 || i != 39) {
+		user_panic("ipc_recv_timeout returned %d with %d", r, i);
+	}
+	wait(who);
+	debugf("sleeptest passed\n");
+	return 0;
+}
@@ -0,0 +1,27 @@
+// Null syscall latency: sys_getenvid (the fast path unless the kernel is built with
+// -DMOS_NO_SYSCALL_FAST) against a syscall failing early in the generic path.
+
+#include <lib.h>
+
+#define ROUNDS 100000
+
+int main() {
+	uint64_t start, fast, slow;
+
+	start = timer_now();
+	for (int i = 0; i < ROUNDS; i++) {
+		syscall_getenvid();
+	}
+	fast = timer_now() - start;
+
+	start = timer_now();
+	for (int i = 0; i < ROUNDS; i++) {
+		// Rejected with -E_INVAL before doing anything.
+		syscall_set_env_status(0, 39);
+	}
+	slow = timer_now() - start;
+
+	debugf("getenvid:       %d ns/call\n", (u_int)(fast * NS_PER_CYCLE / ROUNDS));
+	debugf("set_env_status: %d ns/call\n", (u_int)(slow * NS_PER_CYCLE / ROUNDS));
+	return 0;
+}
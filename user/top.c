@@ -0,0 +1,98 @@
+// Show the envs sorted by CPU usage, refreshing every second.
+// Usage: top [rounds]
+
+#include <lib.h>
+
+#define TOP_INTERVAL 1000000000L // 1 s
+#define CYCLES_PER_MS (TIMER_FREQ / 1000)
+
+struct top_entry {
+	u_int id;
+	u_int status;
+	struct Env_stat st;
+	uint64_t run; // run time during the last interval
+};
+
+static struct Env_stat last[NENV];
+static u_int last_id[NENV];
+static struct top_entry entries[NENV];
+
+static const char *status_name(u_int status) {
+	switch (status) {
+	case ENV_RUNNABLE:
+		return "run";
+	case ENV_NOT_RUNNABLE:
+		return "blk";
+	default:
+		return "?";
+	}
+}
+
+static int collect(void) {
+	int n = 0;
+
+	for (int i = 0; i < NENV; i++) {
+		struct top_entry *t = &entries[n];
+		t->id = envs[i].env_id;
+		t->status = envs[i].env_status;
+		if (t->status == ENV_FREE || syscall_env_stat(t->id, &t->st) < 0) {
+			continue;
+		}
+		t->run = t->st.es_run;
+		if (last_id[i] == t->id) {
+			t->run -= last[i].es_run;
+		}
+		last[i] = t->st;
+		last_id[i] = t->id;
+		n++;
+	}
+	return n;
+}
+
+static void sort(int n) {
+	for (int i = 1; i < n; i++) {
+		struct top_entry t = entries[i];
+		int j = i - 1;
+		while (j >= 0 && entries[j].run < t.run) {
+			entries[j + 1] = entries[j];
+			j--;
+		}
+		entries[j + 1] = t;
+	}
+}
+
+static void show(int n) {
+	printf("\033[2J\033[H");
+	printf("envid     st    cpu   run(ms)  wait(ms) block(ms)   ipc(ms)    vol  invol   runs\n");
+	for (int i = 0; i < n; i++) {
+		struct top_entry *t = &entries[i];
+		printf("%08x  %3s  %4u  %8u  %8u  %8u  %8u  %5u  %5u  %5u\n", t->id,
+		       status_name(t->status), (u_int)(t->run * 100 / ns2cycles(TOP_INTERVAL)),
+		       (u_int)(t->st.es_run / CYCLES_PER_MS), (u_int)(t->st.es_wait / CYCLES_PER_MS),
+		       (u_int)(t->st.es_block / CYCLES_PER_MS), (u_int)(t->st.es_ipc / CYCLES_PER_MS),
+		       t->st.es_voluntary, t->st.es_involuntary, t->st.es_runs);
+	}
+}
+
+int main(int argc, char **argv) {
+	int rounds = -1;
+
+	if (argc > 1) {
+		rounds = 0;
+		for (char *p = argv[1]; *p >= '0' && *p <= '9'; p++) {
+			rounds = rounds * 10 + *p - '0';
+		}
+	}
+
+	collect();
+	while (rounds != 0) {
+		syscall_sleep(TOP_INTERVAL);
+		int n = collect();
+		sort(n);
+		show(n);
+		if (rounds > 0) {
+			rounds--;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,34 @@
+// Exit statuses: wait blocks until the child exits and returns its status, which is still known
+// after the child is gone.
+
+#include <lib.h>
+
+int main() {
+	u_int child;
+	int r;
+
+	if ((child = fork()) == 0) {
+		syscall_sleep(10000000L);
+		exit_with(7);
+	}
+	if ((r = wait(child)) != 7) {
+		user_panic("wait returned %d", r);
+	}
+	if ((r = wait(child)) != 7) {
+		user_panic("wait after exit returned %d", r);
+	}
+
+	// The return value of 'main' is the exit status, truncated to 'EXIT_STATUS_MASK'.
+	if ((child = fork()) == 0) {
+		return 0x1234;
+	}
+	if ((r = wait(child)) != 0x34) {
+		user_panic("wait returned %d for the return of main", r);
+	}
+
+	if ((r = wait(syscall_getenvid())) != -E_INVAL) {
+		user_panic("waiting for itself returned %d", r);
+	}
+	debugf("waittest passed\n");
+	return 0;
+}